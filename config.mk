@@ -15,6 +15,12 @@ export CFLAGS = \
 	-Wextra \
 	$(INCLUDE)
 
+# make KMALLOC_PROFILE=1 records every kernel allocation by call site, see include/kprof.h.
+# call sites are found through frame pointers, so they have to be kept
+ifdef KMALLOC_PROFILE
+CFLAGS += -DKMALLOC_PROFILE -fno-omit-frame-pointer
+endif
+
 export LDFLAGS = \
 	-T linker.ld \
 	-Map=maestro.map \
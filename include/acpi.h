@@ -0,0 +1,57 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: acpi.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: reading the firmware's ACPI tables
+ */
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <maestro.h>
+
+// root system description pointer, found by scanning the bios areas for its signature
+struct acpi_rsdp
+{
+	char sig[8];          // "RSD PTR "
+	u8 checksum;          // the first 20 bytes sum to 0
+	char oem[6];
+	u8 revision;
+	u32 rsdt;             // physical address of the rsdt
+} __attribute__((packed));
+
+// header every table starts with
+struct acpi_sdt
+{
+	char sig[4];
+	u32 length;           // of the whole table, header included
+	u8 revision;
+	u8 checksum;          // the whole table sums to 0
+	char oem[6];
+	char oem_table[8];
+	u32 oem_revision;
+	u32 creator;
+	u32 creator_revision;
+} __attribute__((packed));
+
+// multiple apic description table, signature "APIC"
+struct acpi_madt
+{
+	struct acpi_sdt header;
+	u32 lapic;            // physical address of the local apics
+	u32 flags;
+	u8 entries[];         // variable length entries, each starting with its type and length
+} __attribute__((packed));
+
+// madt entry types
+#define MADT_LAPIC          0    // a processor and its local apic
+#define MADT_LAPIC_OVERRIDE 5    // 64 bit address of the local apics
+
+// MADT_LAPIC flags
+#define MADT_LAPIC_ENABLED  1
+
+int acpi_find_cpus(u8 *, int, uintptr_t *);
+
+#endif    // ACPI_H
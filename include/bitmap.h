@@ -13,7 +13,10 @@
 
 #include <maestro.h>
 
-void BITMAP_SET(u32 *bitmap, int bit)
+// number of u32 words needed to hold a bitmap of n bits
+#define BITMAP_WORDS(n) (((n) + 31) / 32)
+
+static inline void BITMAP_SET(u32 *bitmap, int bit)
 {
 	int i = bit / 32;
 	int pos = bit % 32;
@@ -21,7 +24,7 @@ void BITMAP_SET(u32 *bitmap, int bit)
 	bitmap[i] |= flag;
 }
 
-void BITMAP_CLEAR(u32 *bitmap, int bit)
+static inline void BITMAP_CLEAR(u32 *bitmap, int bit)
 {
 	int i = bit / 32;
 	int pos = bit % 32;
@@ -29,7 +32,7 @@ void BITMAP_CLEAR(u32 *bitmap, int bit)
 	bitmap[i] &= ~flag;
 }
 
-bool BITMAP_TEST(u32 *bitmap, int bit)
+static inline bool BITMAP_TEST(u32 *bitmap, int bit)
 {
 	int i = bit / 32;
 	int pos = bit % 32;
@@ -43,21 +46,17 @@ bool BITMAP_TEST(u32 *bitmap, int bit)
  * @param max_bits the maximum bit index this bitmap keeps track of
  * @return index of first set bit or -1 if all are clear
  */
-int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
+static inline int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
 {
-	for (int i = 0; i < max_bits / 32; ++i)
+	for (int i = 0; i < BITMAP_WORDS(max_bits); ++i)
 	{
 		// quickly check if all 32 bits of this u32 are clear to save some work
 		if (bitmap[i] == 0)
 			continue;
 
-		// at least one of the bits in this u32 are set so find it
-		for (int j = 0; j < 32; ++j)
-		{
-			int bit = i * 32 + j;
-			if (BITMAP_TEST(bitmap, bit))
-				return bit;
-		}
+		// at least one of the bits in this u32 are set so bsf finds it
+		int bit = i * 32 + __builtin_ctz(bitmap[i]);
+		return bit < max_bits ? bit : -1;
 	}
 
 	return -1;
@@ -69,20 +68,136 @@ int BITMAP_FIRST_SET(u32 *bitmap, int max_bits)
  * @param max_bits the maximum bit index this bitmap keeps track of
  * @return index of first clear bit or -1 if all are set
  */
-int BITMAP_FIRST_CLEAR(u32 *bitmap, int max_bits)
+static inline int BITMAP_FIRST_CLEAR(u32 *bitmap, int max_bits)
 {
-	for (int i = 0; i < max_bits / 32; ++i)
+	for (int i = 0; i < BITMAP_WORDS(max_bits); ++i)
 	{
 		// quickly check if all 32 bits of this u32 are set to save us some work
 		if (bitmap[i] == 0xffffffff)
 			continue;
 
-		// at least one of the bits in this u32 are clear so find it
-		for (int j = 0; j < 32; ++j)
+		// at least one of the bits in this u32 are clear so bsf finds it
+		int bit = i * 32 + __builtin_ctz(~bitmap[i]);
+		return bit < max_bits ? bit : -1;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief a bitmap with a summary level on top of it
+ *
+ * bit n of the summary is set when word n of the map is completely full,
+ * so looking for a clear bit only has to touch the summary and a single word of the map.
+ * the hint remembers where the last search succeeded, so consecutive allocations
+ * pick up where the previous one left off instead of rescanning the full words at the front.
+ */
+struct sbitmap
+{
+	u32 *map;        // one bit per item, a set bit means the item is in use
+	u32 *summary;    // one bit per word of map, a set bit means that word is full
+	int nbits;       // number of items the bitmap keeps track of
+	int hint;        // word of map to start the next search from
+};
+
+// number of u32 words needed for the summary of a bitmap of n bits
+#define SBITMAP_SUMMARY_WORDS(n) BITMAP_WORDS(BITMAP_WORDS(n))
+
+/**
+ * @brief tests whether a word of the map has no clear bits left
+ * bits past the end of the bitmap count as set so they are never handed out
+ */
+static inline bool sbitmap_word_full(struct sbitmap *sb, int word)
+{
+	u32 w = sb->map[word];
+	int tail = sb->nbits - word * 32;
+
+	if (tail < 32)
+		w |= 0xffffffff << tail;
+
+	return w == 0xffffffff;
+}
+
+/**
+ * @brief builds the summary of a bitmap whose map is already filled in
+ * @param sb bitmap to initialize
+ * @param map storage for the map, BITMAP_WORDS(nbits) words
+ * @param summary storage for the summary, SBITMAP_SUMMARY_WORDS(nbits) words
+ * @param nbits number of items the bitmap keeps track of
+ */
+static inline void sbitmap_init(struct sbitmap *sb, u32 *map, u32 *summary, int nbits)
+{
+	sb->map     = map;
+	sb->summary = summary;
+	sb->nbits   = nbits;
+	sb->hint    = 0;
+
+	for (int i = 0; i < SBITMAP_SUMMARY_WORDS(nbits); i++)
+		summary[i] = 0;
+
+	for (int i = 0; i < BITMAP_WORDS(nbits); i++)
+	{
+		if (sbitmap_word_full(sb, i))
+			BITMAP_SET(summary, i);
+	}
+}
+
+static inline bool sbitmap_test(struct sbitmap *sb, int bit)
+{
+	return BITMAP_TEST(sb->map, bit);
+}
+
+static inline void sbitmap_set(struct sbitmap *sb, int bit)
+{
+	BITMAP_SET(sb->map, bit);
+
+	if (sbitmap_word_full(sb, bit / 32))
+		BITMAP_SET(sb->summary, bit / 32);
+}
+
+static inline void sbitmap_clear(struct sbitmap *sb, int bit)
+{
+	BITMAP_CLEAR(sb->map, bit);
+	BITMAP_CLEAR(sb->summary, bit / 32);
+
+	// freed space behind the hint should be found by the next search
+	if (bit / 32 < sb->hint)
+		sb->hint = bit / 32;
+}
+
+/**
+ * @brief finds a clear bit, starting from the hint and wrapping around once
+ * @param sb bitmap to search
+ * @return index of a clear bit or -1 if all are set
+ */
+static inline int sbitmap_first_clear(struct sbitmap *sb)
+{
+	int words = BITMAP_WORDS(sb->nbits);
+	int nsummary = SBITMAP_SUMMARY_WORDS(sb->nbits);
+	int start = sb->hint < words ? sb->hint : 0;
+
+	// one pass from the hint to the end, then a second from the start up to the hint
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int first = pass == 0 ? start : 0;
+		int last = pass == 0 ? words : start;
+
+		for (int s = first / 32; s < nsummary && s * 32 < last; s++)
 		{
-			int bit = i * 32 + j;
-			if (!BITMAP_TEST(bitmap, bit))
-				return bit;
+			// words in this summary word that are below where we started have already been looked at
+			u32 open = ~sb->summary[s];
+			if (s == first / 32)
+				open &= 0xffffffff << (first % 32);
+
+			if (open == 0)
+				continue;
+
+			int word = s * 32 + __builtin_ctz(open);
+			if (word >= last)
+				break;
+
+			sb->hint = word;
+			return word * 32 + __builtin_ctz(~sb->map[word]);
 		}
 	}
 
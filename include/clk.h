@@ -13,6 +13,11 @@
 #include <maestro.h>
 
 void clk_init();
+u32 clk_take();
+void clk_rearm();
+void clk_wake_by(u32);
+void clk_delay(u32);
 void sleepms(uint);
+u32 uptime();
 
 #endif    // CLK_H
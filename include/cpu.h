@@ -0,0 +1,52 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: cpu.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: cpu feature detection and control registers
+ */
+#ifndef CPU_H
+#define CPU_H
+
+#include <maestro.h>
+
+// feature bits reported in edx by cpuid leaf 1
+#define CPUID_EDX_PSE (1 << 3)     // 4M pages
+#define CPUID_EDX_APIC (1 << 9)    // local apic
+#define CPUID_EDX_PGE (1 << 13)    // global pages
+#define CPUID_EDX_SSE2 (1 << 26)   // sse2, which brings movnti
+
+// cr4 bits
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+
+static inline void cpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
+{
+	asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+/**
+ * @brief tests a feature bit cpuid leaf 1 reports in edx
+ */
+static inline bool cpu_has(u32 edx_bit)
+{
+	u32 eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	return (edx & edx_bit) != 0;
+}
+
+static inline u32 read_cr4()
+{
+	u32 cr4;
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+
+static inline void write_cr4(u32 cr4)
+{
+	asm volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+#endif    // CPU_H
@@ -45,6 +45,11 @@ struct elf_ehdr
 #define PT_LOPROC  0x70000000
 #define PT_HIPROC  0x7fffffff
 
+// segment permission flags
+#define PF_X       1
+#define PF_W       2
+#define PF_R       4
+
 // ELF program header
 struct elf_phdr
 {
@@ -58,7 +63,10 @@ struct elf_phdr
 	u32 p_align;
 };
 
+struct proc;
+
 void run_elf();
+uintptr_t elf_load(struct proc *, u32);
 void print_elf(struct elf_ehdr *);
 void print_elf_phdr(struct elf_phdr *);
 
@@ -206,5 +206,6 @@ void ext2_readdir(u8 *, u32);
 int ext2_read_data(void *, u32, size_t, size_t);
 int ext2_write_data(void *, u32, size_t, size_t);
 size_t ext2_filesize(u32);
+u32 *ext2_data_blocks(u32, u32, u32);
 
 #endif    // EXT2_H
@@ -13,6 +13,7 @@
 #include <maestro.h>
 
 void idt_init();
+void idt_load();
 
 struct idt_entry
 {
@@ -31,6 +31,10 @@
 
 #define SYSCALL        48    // system call interrupt number
 
+#define LAPIC_TIMER    49    // local apic timer, a cpu's quantum is up
+#define IPI_RESCHED    50    // another cpu readied a process for this one
+#define LAPIC_SPURIOUS 63    // local apic spurious interrupt
+
 // state of the registers pushed on the stack when an interrupt occurs 
 // see isr_common in intr.s
 struct registers
@@ -55,10 +59,12 @@ struct registers
 // defined in intr.s
 void intr_init();
 extern void set_vect(u8, void (*)(void));
-extern int disable();
-extern void restore(int);
 
-// defined in isr.c
+// defined in intr.c
+int disable();
+void restore(int);
+void enable();
+void halt();
 void isr(struct registers *);
 
 #endif    // INTR_H
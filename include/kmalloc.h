@@ -12,12 +12,25 @@
 
 #include <maestro.h>
 
+// size in bytes the kernel heap starts out at, it lives at KHEAP_BASE and grows up from there
+#define KHEAP_INIT_SIZE   (64 * 1024)
+
+// smallest amount in bytes the heap grows by at once
+#define KHEAP_GROW_MIN    (64 * 1024)
+
+// size in bytes a free block at the top of the heap has to reach before it's given back
+#define KHEAP_SHRINK_MIN  (256 * 1024)
+
 // minimum size in bytes that can be kmalloc'd
 #define MIN_ALLOCATION    8
 
 // size of the header for an allocated block
 #define ALLOC_HEADER_SIZE (sizeof(struct header) - (2 * sizeof(struct header *)))
 
+// number of segregated free lists
+// list n holds free blocks of exactly (n + 1) * 8 bytes, the last one holds everything bigger
+#define N_LISTS           59
+
 /**
  * @brief represents the allocation state of an object
  */
@@ -25,7 +38,7 @@ enum state
 {
 	UNALLOCATED = 0,
 	ALLOCATED   = 1,
-	SENTINAL    = 2,
+	SENTINAL    = 2,    // free list heads and the fenceposts at either end of the heap
 };
 
 /**
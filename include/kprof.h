@@ -0,0 +1,55 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: kprof.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: kernel allocation profiler
+ *
+ * Built with KMALLOC_PROFILE (make KMALLOC_PROFILE=1), every kernel allocator records
+ * who asked for each object it hands out, and kprof_dump prints live bytes and allocation
+ * rates grouped by call site. meta/kprof.sh resolves the call sites against maestro.map.
+ * Without it, the hooks compile away to nothing.
+ */
+#ifndef KPROF_H
+#define KPROF_H
+
+#include <maestro.h>
+
+// return addresses recorded per call site, enough to see past wrappers like strdup -> strndup -> kmalloc
+#define KPROF_DEPTH   3
+
+// most live allocations tracked at once, any more go uncounted
+#define KPROF_ALLOCS  4096
+
+// most distinct call sites tracked
+#define KPROF_SITES   256
+
+#ifdef KMALLOC_PROFILE
+
+void kprof_alloc(void *, size_t);
+void kprof_free(void *);
+int kprof_dump();
+
+#else
+
+static inline void kprof_alloc(void *p, size_t size)
+{
+	(void) p;
+	(void) size;
+}
+
+static inline void kprof_free(void *p)
+{
+	(void) p;
+}
+
+static inline int kprof_dump()
+{
+	return -1;
+}
+
+#endif    // KMALLOC_PROFILE
+
+#endif    // KPROF_H
@@ -0,0 +1,32 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: lapic.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: each cpu's local apic: its timer and interprocessor interrupts
+ */
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <maestro.h>
+
+// interrupt command register delivery modes and flags
+#define ICR_FIXED    0x000
+#define ICR_INIT     0x500
+#define ICR_STARTUP  0x600
+#define ICR_PENDING  0x1000    // the last ipi hasn't been delivered yet
+#define ICR_ASSERT   0x4000
+#define ICR_LEVEL    0x8000
+
+int lapic_setup(uintptr_t);
+void lapic_init();
+void lapic_calibrate();
+u8 lapic_id();
+void lapic_eoi();
+void lapic_ipi(u8, u32);
+bool lapic_timer_ready();
+bool lapic_timer_arm(u32);
+
+#endif    // LAPIC_H
@@ -0,0 +1,79 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: list.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: intrusive doubly linked lists
+ *
+ * The links live inside the objects on the list, so adding and removing never allocates
+ * and an object can be taken off whatever list it is on without searching for it. A list
+ * is a circular ring through a head node: an empty list is a head pointing at itself.
+ * list_entry gets back from a node to the object it is embedded in.
+ */
+#ifndef LIST_H
+#define LIST_H
+
+#include <maestro.h>
+
+struct list_head
+{
+	struct list_head *next;
+	struct list_head *prev;
+};
+
+// object of a given type whose member is the node
+#define list_entry(node, type, member) ((type *) ((u8 *) (node) - offsetof(type, member)))
+
+static inline void list_init(struct list_head *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+/**
+ * @brief adds a node to the back of a list
+ * @param head list to add to
+ * @param node node that isn't on any list
+ */
+static inline void list_append(struct list_head *head, struct list_head *node)
+{
+	node->next = head;
+	node->prev = head->prev;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+/**
+ * @brief takes a node off the list it is on
+ * @param node node to remove, left pointing at itself
+ */
+static inline void list_unlink(struct list_head *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	list_init(node);
+}
+
+/**
+ * @brief takes the node at the front of a list off it
+ * @param head list to take from
+ * @return the node or NULL if the list is empty
+ */
+static inline struct list_head *list_pop_front(struct list_head *head)
+{
+	if (list_empty(head))
+		return NULL;
+
+	struct list_head *node = head->next;
+	list_unlink(node);
+	return node;
+}
+
+#endif    // LIST_H
@@ -0,0 +1,35 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: lz.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: fast lz77 compression
+ *
+ * Compressed data is a series of sequences, each a token byte followed by a run of
+ * literal bytes and then a match: a 16 bit little endian offset back into what has
+ * already been decompressed and a length. The high nibble of the token is the number of
+ * literals and the low nibble the match length minus LZ_MIN_MATCH; a nibble of 15 means
+ * more length bytes follow, each added on until one isn't 255. The last sequence has
+ * literals only. It is the lz4 block format, which trades ratio for being cheap enough
+ * to run on every page that gets reclaimed.
+ */
+#ifndef LZ_H
+#define LZ_H
+
+#include <maestro.h>
+
+// log2 of the number of entries in the compressor's table of recently seen sequences
+#define LZ_HASH_BITS 12
+
+// size in bytes of the workspace lz_compress needs
+#define LZ_WORK_SIZE ((1 << LZ_HASH_BITS) * sizeof(u16))
+
+// shortest match worth encoding
+#define LZ_MIN_MATCH 4
+
+size_t lz_compress(const void *, size_t, void *, size_t, void *);
+size_t lz_decompress(const void *, size_t, void *, size_t);
+
+#endif    // LZ_H
@@ -0,0 +1,36 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: memstat.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: process memory statistics shared with the C library's sys/memstat.h
+ */
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <maestro.h>
+
+// what the memstat syscall returns for a pid with no process, and for one past the end of the process table
+#define MEMSTAT_NOPROC -1
+#define MEMSTAT_END    -2
+
+/**
+ * memory usage of a process, filled in by the memstat syscall
+ * page counts are as of the last usage scan, see vmm_scan_usage
+ */
+struct memstat
+{
+	int pid;
+	int parent;
+	int state;
+	char name[32];
+	u32 rss;        // resident user pages
+	u32 dirty;      // resident pages written to since they were brought in
+	u32 wss;        // pages touched between the last two scans
+	u32 faults;     // page faults resolved
+	u32 swapins;    // page faults that brought a page back from swap
+};
+
+#endif    // MEMSTAT_H
@@ -0,0 +1,48 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: mman.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: memory mapping definitions shared with the C library's sys/mman.h
+ */
+#ifndef MMAN_H
+#define MMAN_H
+
+#include <maestro.h>
+
+// protection of a mapping
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+// type of a mapping
+#define MAP_SHARED    1
+#define MAP_PRIVATE   2
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_LARGE     0x40    // back an anonymous mapping with 4M pages, rounds it to 4M
+
+// msync flags
+#define MS_ASYNC      1
+#define MS_INVALIDATE 2
+#define MS_SYNC       4
+
+/**
+ * arguments of the mmap syscall
+ * there are more of them than registers available to syscalls,
+ * so the C library passes a pointer to this struct in ebx instead
+ */
+struct mmap_args
+{
+	void *addr;
+	size_t len;
+	int prot;
+	int flags;
+	int fd;
+	size_t off;
+};
+
+#endif    // MMAN_H
@@ -0,0 +1,24 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: pcache.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: page cache for ext2 file data
+ *
+ * The page cache keeps page sized pieces of files in physical frames so file
+ * mappings can map them straight into a process instead of copying out of the
+ * disk each time. A cached frame is shared by every mapping of that part of the file.
+ * Once nothing maps a page it stays cached until memory runs short, see pcache_shrink.
+ */
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <maestro.h>
+
+uintptr_t pcache_get(u32, u32);
+void pcache_update(u32, size_t, const void *, size_t);
+size_t pcache_shrink(size_t, bool);
+
+#endif    // PCACHE_H
@@ -29,7 +29,67 @@
 // rounds a number up to the nearest block alignment
 #define BLOCK_ALIGN(n) ((n + (BLOCK_SIZE - 1)) & -BLOCK_SIZE)
 
+// largest order the buddy allocator hands out (2^10 blocks = 4M)
+#define PMM_MAX_ORDER  10
+
+// number of blocks the idle loop keeps zeroed ahead of time for pmm_alloc_zeroed
+#define ZERO_POOL_SIZE 64
+
+// page flags, see struct page
+#define PG_DIRTY      0x01    // contents are newer than the copy on disk, write them back before dropping the block
+#define PG_LOCKED     0x02    // pinned in memory, never evicted
+#define PG_ZEROED     0x04    // sitting in the zero pool, known to hold nothing but zeroes
+#define PG_PCACHE     0x08    // holds a page of a file for the page cache, owner is its struct cached_page
+#define PG_PAGETABLE  0x10    // page directory or page table
+#define PG_SWAPCACHE  0x20    // the swap slot in swap_entry still holds an up to date copy of the block
+#define PG_ZRAM       0x40    // holds compressed pages for zram, see zfirst and zlast
+#define PG_REFERENCED 0x80    // a usage scan found the page accessed since the swap clock last passed it
+
+/**
+ * @brief bookkeeping for a single block of physical memory, indexed by block number
+ *
+ * free memory is kept as runs of 2^order blocks, each aligned to its own size.
+ * only the first block of a run carries meaningful information; the free list
+ * links are block indeces rather than pointers so they stay valid no matter
+ * where the array itself lives. a free run needs its links and an allocated one
+ * needs its owner and swap slot (or zram entries), never both, so they share space.
+ */
+struct page
+{
+	union
+	{
+		struct
+		{
+			u32 next;    // index of next free run of the same order
+			u32 prev;    // index of previous free run of the same order
+		};
+		struct
+		{
+			void *owner;     // allocated: the struct cached_page of a PG_PCACHE block, the struct proc of a user page
+			u32 swap_entry;  // allocated: swap pte of the slot of a PG_SWAPCACHE block, see swap_in
+		};
+		struct
+		{
+			u32 zfirst;      // allocated PG_ZRAM block: zram entry stored at its start, or 0
+			u32 zlast;       // allocated PG_ZRAM block: zram entry stored at its end, or 0
+		};
+	};
+	u8 order;            // order of the run this block heads
+	u8 free;             // set if this block heads a free run
+	u16 refs;            // number of mappings sharing this block, see pmm_ref
+	u16 flags;           // PG_* flags
+};
+
 void pmm_init();
 uintptr_t pmm_alloc();
+uintptr_t pmm_alloc_order(uint);
+uintptr_t pmm_alloc_zeroed();
+bool pmm_refill_zeroed();
+void pmm_free(uintptr_t, uint);
+void pmm_ref(uintptr_t);
+void pmm_unref(uintptr_t);
+uint pmm_refcount(uintptr_t);
+uintptr_t pmm_mem_top();
+struct page *pmm_page(uintptr_t);
 
 #endif    // PMM_H
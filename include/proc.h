@@ -10,10 +10,14 @@
 #ifndef PROC_H
 #define PROC_H
 
+#include <list.h>
 #include <maestro.h>
+#include <smp.h>
+#include <timer.h>
 #include <vfs.h>
 
 struct registers;
+struct vma;
 
 // max number of processes (for now),
 #define NPROC  100
@@ -23,6 +27,18 @@ struct registers;
 
 #define PR_STACKSIZE 4096
 
+// number of scheduler priority levels, 0 is the highest
+#define NPRIO 4
+
+// ms a process at the top level runs before it is preempted, each level down doubles it
+#define SCHED_QUANTUM 5
+
+// every process goes back to its base level this often (ms), so cpu hogs can't starve
+#define SCHED_BOOST_MS 1000
+
+// size of the area reserved for a user stack, including the argv/envp page at the top
+#define USTACK_SIZE  (256 * 1024)
+
 enum prstate
 {
 	PR_READY,
@@ -44,24 +60,61 @@ struct proc
 	int pid;                       // process id
 	int parent;                    // parent process id
 	int waiting_for;               // pid this process is waiting for
+	int exit_status;               // status passed to exit, collected by waitpid
 	int mask;                      // interrupt state mask
 	struct file *ofile[NOFILE];    // open file table
-	u32 wakeup;                    // timestamp to wake up process when sleeping
+	struct timer sleep_timer;      // wakes the process up when sleeping
 	void *sbrk;                    // address of system break
+	struct vma *vmas;              // areas of the user address space
 	char name[32];
+
+	// memory usage, page counts are refreshed by vmm_scan_usage
+	u32 rss;                       // resident user pages
+	u32 dirty;                     // resident pages written to since they were brought in
+	u32 wss;                       // pages touched since the previous scan
+	u32 faults;                    // page faults resolved
+	u32 swapins;                   // page faults that brought a page back from swap
+
+	// scheduling, see sched.c
+	int prio;                      // level of the ready queue the process is on, 0 is the highest
+	int nice;                      // base level, where the process starts and is boosted back to
+	u32 slice;                     // ms left of its quantum at the current level
+	int cpu;                       // cpu the process last ran on, or whose ready queue it is on
+	struct list_head link;         // ready queue or semaphore wait queue the process is on
 };
 
+// process running on the cpu this is running on
+#define curr (this_cpu()->proc)
+
+/**
+ * @brief checks whether a process is running on another cpu right now
+ * its page tables are in use over there, with bits the cpu may be setting in them at any time
+ */
+static inline bool proc_running_elsewhere(struct proc *pptr)
+{
+	return pptr->state == PR_RUNNING && pptr != curr;
+}
+
 // defined in ctxsw.s
 extern void ctxsw(void *, void *);
 
 // defined in sched.c
 void sched();
+void ready(struct proc *);
+void sched_init();
+void sched_idle();
+void sched_tick(u32);
+u32 sched_next();
+void sched_wakeup(struct proc *);
+bool sched_pending();
+u32 sched_quantum(int);
 
 void proc_init();
 struct proc *create(void (*func)(void), const char *);
+struct proc *create_idle(int);
 struct proc *create_usermode(const char *);
-void ready(struct proc *);
 void proc_exit(int);
 int proc_fork(struct registers *);
+void proc_reap(struct proc *);
 
 #endif    // PROC_H
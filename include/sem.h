@@ -11,12 +11,12 @@
 #ifndef SEM_H
 #define SEM_H
 
-#include <queue.h>
+#include <list.h>
 
 struct sem
 {
 	int count;
-	struct queue *waitq;
+	struct list_head waitq;
 };
 
 void sem_init();
@@ -0,0 +1,60 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: slab.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: object caches for fixed-size kernel objects
+ *
+ * A cache hands out objects of a single size from slabs, runs of physical blocks
+ * reached through the direct map. Objects are carved out of the slab back to back, so
+ * allocating and freeing is a push or pop on the slab's stack of free objects and
+ * the general heap is left to variable-sized buffers.
+ */
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <maestro.h>
+
+// largest slab a cache will use, 2^SLAB_MAX_ORDER blocks
+#define SLAB_MAX_ORDER 3
+
+// header at the start of every slab, followed by its free stack and then the objects
+struct slab
+{
+	struct kmem_cache *cache;
+	struct slab *next;
+	struct slab *prev;
+	void *objs;          // first object of the slab
+	uint nfree;          // number of objects on the free stack
+	u16 free[];          // indices of the free objects, the top of the stack is free[nfree - 1]
+};
+
+struct kmem_cache
+{
+	const char *name;
+	size_t size;                 // object size, rounded up to a multiple of 8
+	uint order;                  // each slab is 2^order blocks
+	uint per_slab;               // number of objects in a slab
+	void (*ctor)(void *);        // run once on every object when its slab is created
+
+	struct slab *partial;        // slabs with some objects free
+	struct slab *full;           // slabs with no objects free
+	struct slab *empty;          // slabs with every object free
+
+	// statistics
+	uint allocs;                 // objects handed out
+	uint frees;                  // objects given back
+	uint active;                 // objects currently handed out
+	uint slabs;                  // slabs currently owned by the cache
+
+	struct kmem_cache *next;     // list of every cache, for print_slabinfo
+};
+
+struct kmem_cache *kmem_cache_create(const char *, size_t, void (*)(void *));
+void *kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+void print_slabinfo();
+
+#endif    // SLAB_H
@@ -0,0 +1,111 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: smp.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: per cpu data and bringing up the other cpus
+ *
+ * Every cpu has a struct cpu with its own gdt, tss, running process and null process.
+ * The per cpu segment in its gdt has the struct as its base, so %gs always points at
+ * the struct of the cpu the code is running on.
+ *
+ * The kernel still runs on one cpu at a time. A cpu holds the kernel lock exactly when
+ * it has interrupts off: disable() and interrupt entry take it, restore() and returning
+ * to code with interrupts on give it up. Every critical section the kernel had on one
+ * cpu keeps working on all of them, and user code runs on every cpu at once.
+ */
+#ifndef SMP_H
+#define SMP_H
+
+#include <maestro.h>
+
+// most cpus the kernel will bring up
+#define NCPU 8
+
+// physical page application processors start executing in, real mode code has to be below 1M
+#define AP_TRAMPOLINE 0x8000
+
+// segment selectors, the same in every cpu's gdt
+#define SEL_KCODE  0x08
+#define SEL_KDATA  0x10
+#define SEL_UCODE  0x18
+#define SEL_UDATA  0x20
+#define SEL_TSS    0x28
+#define SEL_PERCPU 0x30
+
+#define GDT_ENTRIES 7
+
+struct proc;
+
+struct tss
+{
+	u32 prev;
+	u32 esp0;      // stack the cpu switches to when an interrupt comes in from user mode
+	u32 ss0;
+	u32 esp1;
+	u32 ss1;
+	u32 esp2;
+	u32 ss2;
+	u32 cr3;
+	u32 eip;
+	u32 eflags;
+	u32 eax;
+	u32 ecx;
+	u32 edx;
+	u32 ebx;
+	u32 esp;
+	u32 ebp;
+	u32 esi;
+	u32 edi;
+	u32 es;
+	u32 cs;
+	u32 ss;
+	u32 ds;
+	u32 fs;
+	u32 gs;
+	u32 ldt;
+	u16 trap;
+	u16 iomap;     // offset of the io permission bitmap, past the end of the tss so there is none
+} __attribute__((packed));
+
+struct cpu
+{
+	struct cpu *self;            // this struct, read through %gs to find it
+	int id;                      // index into cpus
+	u8 apic_id;                  // id of the cpu's local apic
+	struct proc *proc;           // process running on the cpu
+	struct proc *idle;           // null process, runs when nothing else can
+	u32 charged_at;              // uptime the running process was last charged up to, see clk_take
+	u32 tlb_gen;                 // kernel_tlb_gen the cpu's tlb was last flushed at
+	volatile bool started;       // the cpu made it out of the trampoline
+	bool online;                 // the cpu is scheduling processes
+
+	u64 gdt[GDT_ENTRIES];
+	struct tss tss;
+};
+
+extern struct cpu cpus[];
+extern int ncpu;
+
+/**
+ * @brief struct cpu of the cpu this is running on
+ * a process can move to another cpu whenever it calls sched(), so this is read every time
+ */
+static inline struct cpu *this_cpu()
+{
+	struct cpu *c;
+	asm volatile("mov %%gs:0, %0" : "=r"(c));
+	return c;
+}
+
+void smp_early_init();
+void smp_init();
+void smp_resched(int);
+void smp_kernel_unmapped();
+void klock_acquire();
+void klock_release();
+void set_task(u32);
+
+#endif    // SMP_H
@@ -0,0 +1,48 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: spinlock.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: busy waiting locks for data shared between cpus
+ *
+ * A spinlock doesn't disable interrupts, a lock that an interrupt handler also takes
+ * has to be taken with interrupts off or the handler can spin on its own cpu forever.
+ */
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <maestro.h>
+
+struct spinlock
+{
+	volatile u32 locked;
+};
+
+static inline void spin_init(struct spinlock *lock)
+{
+	lock->locked = 0;
+}
+
+static inline bool spin_trylock(struct spinlock *lock)
+{
+	return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	while (!spin_trylock(lock))
+	{
+		// wait with plain reads, so the cache line isn't bounced between cpus while it's held
+		while (lock->locked)
+			asm volatile("pause");
+	}
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	__sync_lock_release(&lock->locked);
+}
+
+#endif    // SPINLOCK_H
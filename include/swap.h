@@ -0,0 +1,34 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: swap.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: paging anonymous user memory out to disk
+ *
+ * Swap space is a preallocated file on the root filesystem, cut into page-sized slots.
+ * When physical memory runs out, a clock hand sweeps the user page tables of every
+ * process and writes out a page that hasn't been accessed since the hand last passed it.
+ * Its pte is left non-present with PT_SWAP set and the slot number in place of the frame,
+ * and the next touch of the page reads it back in (see vmm_page_fault). Pages that
+ * compress well never reach the disk, zram keeps them in memory instead.
+ */
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <maestro.h>
+
+// swap file, made by meta/make_disk.sh
+#define SWAP_FILE "/swap"
+
+// slot number (or zram entry, with PT_ZRAM) held by a PT_SWAP pte
+#define SWAP_SLOT(pte) ((pte) >> 12)
+
+void swap_init();
+bool swap_out();
+bool swap_in(uintptr_t, bool);
+void swap_dup(u32);
+void swap_free(u32);
+
+#endif    // SWAP_H
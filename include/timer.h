@@ -0,0 +1,40 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: timer.h
+ * DATE: October 18th, 2026
+ * DESCRIPTION: kernel timers on a hierarchical timing wheel
+ *
+ * A timer calls a function once its deadline, an uptime in ms, has passed. Timers are kept
+ * in the slots of a wheel by when they expire, so adding and cancelling one is a list
+ * operation no matter how many are pending. The clock interrupt brings the wheel up to the
+ * current ms and runs everything in the slots it passes, and the timers stay in the struct
+ * they are embedded in, so nothing is allocated.
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <list.h>
+#include <maestro.h>
+
+struct timer
+{
+	struct list_head link;     // wheel slot the timer is in, points at itself when not pending
+	u32 expires;               // uptime in ms the timer goes off at
+	u32 period;                // ms between expiries of a periodic timer, 0 for a one-shot
+	void (*fn)(void *);        // called from the clock interrupt, with interrupts off
+	void *arg;                 // passed to fn
+};
+
+void timer_init();
+void timer_setup(struct timer *, void (*)(void *), void *);
+void timer_add(struct timer *, u32);
+void timer_add_periodic(struct timer *, u32);
+bool timer_cancel(struct timer *);
+bool timer_pending(struct timer *);
+void timer_tick(u32);
+u32 timer_next(u32);
+
+#endif    // TIMER_H
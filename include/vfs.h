@@ -29,11 +29,13 @@ struct file
 	size_t pos;            // seek offset
 
 	struct vnode *n;    // reference to vfs node this open file represents
+	int refs;           // number of file table entries sharing this open file (fork)
 };
 
 void vfs_init();
 struct vnode *vfs_mkdir(char *);
 struct vnode *vfs_touch(char *);
+struct vnode *vfs_lookup(char *);
 int vfs_open(char *);
 int vfs_close(int);
 int vfs_seek(int, int);
@@ -0,0 +1,44 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: vma.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: virtual memory areas of a process
+ *
+ * A virtual memory area describes a range of a process's address space and
+ * what should appear there, without any memory being committed to it. Pages of an
+ * area are only allocated and filled in when they are first touched (see vmm_page_fault).
+ */
+#ifndef VMA_H
+#define VMA_H
+
+#include <maestro.h>
+
+// area flags
+#define VMA_WRITE  1    // pages of this area may be written
+#define VMA_SHARED 2    // file pages are shared with the page cache and written back, not copied
+#define VMA_LARGE  4    // anonymous area backed by 4M pages where possible, start and end are 4M aligned
+
+struct vma
+{
+	uintptr_t start;     // first address of the area (page aligned)
+	uintptr_t end;       // address one past the last byte of the area (page aligned)
+	unsigned flags;      // VMA_* flags
+	u32 inode;           // inode of the file backing this area, or 0 for anonymous memory
+	size_t off;          // offset in the file that start maps to
+	size_t filesz;       // number of bytes past start that come from the file, the rest is zero filled
+	struct vma *next;
+};
+
+struct vma *vma_map(struct vma **, uintptr_t, uintptr_t, unsigned, u32, size_t, size_t);
+struct vma *vma_find(struct vma *, uintptr_t);
+struct vma *vma_dup(struct vma *);
+void vma_free(struct vma **);
+struct vma *vma_overlap(struct vma *, uintptr_t, uintptr_t);
+void vma_sync(struct vma *, uintptr_t, uintptr_t);
+void vma_unmap(struct vma **, uintptr_t, uintptr_t);
+bool vma_splits_large(struct vma *, uintptr_t, uintptr_t);
+
+#endif    // VMA_H
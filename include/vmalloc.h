@@ -0,0 +1,29 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: vmalloc.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: virtually contiguous kernel allocations
+ *
+ * vmalloc backs each page of an allocation with its own frame and maps them next to
+ * each other between VMALLOC_BASE and VMALLOC_END, so big buffers never need physically
+ * contiguous memory and stay out of the kmalloc heap. Every allocation is followed by an
+ * unmapped guard page, so running off the end faults instead of corrupting a neighbor.
+ * ioremap hands out ranges of the same area for memory the pmm doesn't manage, like
+ * device registers, mapping them to the physical addresses asked for.
+ */
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <maestro.h>
+
+void *vmalloc(size_t);
+void vfree(void *);
+void *kvmalloc(size_t);
+void kvfree(void *);
+void *ioremap(uintptr_t, size_t);
+void iounmap(void *);
+
+#endif    // VMALLOC_H
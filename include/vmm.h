@@ -33,13 +33,45 @@
 // physical address the bootloader placed the kernel page table
 #define KPAGE_TABLE_BASE       (u8 *) 0xa000
 
+// first virtual address of kernel space, everything below belongs to user processes
+#define KERNEL_BASE            0xc0000000
+
+// virtual address where all of physical memory is mapped linearly, using 4M pages when the cpu has them
+#define PHYS_MAP_BASE          0xd0000000
+
+// largest amount of physical memory the direct map covers, the pmm ignores memory above it
+#define PHYS_MAP_SIZE          0x20000000
+
+// virtual address range the kernel heap grows into, right above the direct map
+#define KHEAP_BASE             0xf0000000
+#define KHEAP_MAX_SIZE         0x4000000
+
+// virtual address range for vmalloc, from the end of the heap's range up to the recursive mapping
+#define VMALLOC_BASE           (KHEAP_BASE + KHEAP_MAX_SIZE)
+#define VMALLOC_END            0xffc00000
+
+// size of a large (pse) page in bytes
+#define LARGE_PAGE_SIZE        0x400000
+
 // flag bitmasks for pt_entries
 #define PT_PRESENT 1
 #define PT_WRITABLE 2
 #define PT_USER 4
+#define PT_PWT 0x08     // write-through
+#define PT_PCD 0x10     // caching disabled, for device memory
 #define PT_ACCESSED 0x20
 #define PT_DIRTY 0x40
-#define PT_FRAME 0x7ffff000
+#define PT_LARGE 0x80   // pde maps a 4M page directly instead of pointing to a page table (cr4.pse)
+#define PT_GLOBAL 0x100 // kernel page that is the same in every address space, survives cr3 reloads (cr4.pge)
+#define PT_COW 0x200    // available to the os: page is shared copy-on-write
+#define PT_SWAP 0x400   // available to the os: not present, the page is in swap and the frame bits hold its slot
+#define PT_ZRAM 0x800   // available to the os: with PT_SWAP, the page is compressed in memory and the frame bits hold its zram entry
+#define PT_FRAME 0xfffff000
+
+// page fault error code bits
+#define PF_PRESENT 1    // fault was a protection violation on a present page
+#define PF_WRITE 2      // faulting access was a write
+#define PF_USER 4       // fault happened in user mode
 
 // page directory entry
 struct pde
@@ -69,11 +101,41 @@ struct pte
 	u32 addr    : 20;    // physical frame address this entry manages
 } __attribute__((packed));
 
+struct registers;
+
 void vmm_init();
 
 uintptr_t vmm_create_address_space();
-void vmm_map_page(uintptr_t, uintptr_t, unsigned);
-void vmm_map_page_in_pdir(uintptr_t, uintptr_t, uintptr_t, unsigned);
+void vmm_destroy_address_space(uintptr_t);
+void vmm_drop_page(u32);
+int vmm_map_page(uintptr_t, uintptr_t, unsigned);
+int vmm_map_page_in_pdir(uintptr_t, uintptr_t, uintptr_t, unsigned);
+int vmm_map_range(uintptr_t, const uintptr_t *, uintptr_t, size_t, unsigned);
+int vmm_map_kernel(uintptr_t, size_t);
+void vmm_unmap_kernel(uintptr_t, size_t);
+int vmm_map_mmio(uintptr_t, uintptr_t, size_t);
+void vmm_unmap_mmio(uintptr_t, size_t);
+u32 *vmm_get_pte(uintptr_t);
+u32 *vmm_get_pde(uintptr_t);
+void vmm_zero_frames(uintptr_t, size_t);
+void vmm_copy_frames(uintptr_t, uintptr_t, size_t);
+bool vmm_has_large_pages();
+uintptr_t virt_to_phys(const void *);
+bool vmm_page_fault(struct registers *);
+void vmm_scan_usage();
+
+/**
+ * @brief kernel address of a physical address, through the direct map
+ * every frame the pmm hands out is covered, so this never has to map anything
+ */
+static inline void *phys_to_virt(uintptr_t phys)
+{
+	return (void *) (PHYS_MAP_BASE + phys);
+}
 
+static inline void invlpg(uintptr_t virt)
+{
+	asm volatile("invlpg (%0)" :: "r"(virt) : "memory");
+}
 
 #endif // VMM_H
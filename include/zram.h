@@ -0,0 +1,38 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: zram.h
+ * DATE: October 17th, 2026
+ * DESCRIPTION: compressed in-memory swap
+ *
+ * Before a page goes out to the disk, swap tries to keep it in memory compressed.
+ * Pages that are a single repeated word (most often zero) are kept as just that word.
+ * Others are compressed with lz and packed two to a block, one at the start and one at
+ * the end, so a block is freed for every two pages stored and a store never has to
+ * allocate: a page with nobody to pair with turns its own block into the first half of
+ * a new pair. Pages are named by an index into a table of entries, which a swapped out
+ * pte holds in place of its frame (see PT_ZRAM).
+ */
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <maestro.h>
+
+// compressed pages are placed in blocks by how much room is left, in units of this many bytes
+#define ZRAM_CHUNK   64
+
+// pages that don't compress to this size or smaller go to the disk instead
+#define ZRAM_MAX_LEN (PAGE_SIZE * 3 / 4)
+
+// while pages aren't compressing well, only one in this many is tried
+#define ZRAM_PROBE   16
+
+void zram_init();
+u32 zram_store(uintptr_t, bool, bool *);
+bool zram_load(u32, uintptr_t);
+void zram_dup(u32);
+void zram_free(u32);
+
+#endif    // ZRAM_H
@@ -19,6 +19,9 @@
 // size in bytes of chunks requested from OS
 #define ARENA_SIZE 4096
 
+// requests of at least this many bytes get their own anonymous mapping instead of heap space
+#define MMAP_THRESHOLD (64 * 1024)
+
 // number of freelists
 #define N_LISTS 59
 
@@ -36,6 +39,7 @@ enum state
 	UNALLOCATED = 0,
 	ALLOCATED   = 1,
 	FENCEPOST   = 2,
+	MAPPED      = 3,    // allocated with its own mmap, size is the length of the mapping
 };
 
 /**
@@ -0,0 +1,7 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+// gives the cpu to another process of the same priority, if one is ready
+int sched_yield(void);
+
+#endif    // SCHED_H
@@ -0,0 +1,8 @@
+#ifndef SYS_KPROF_H
+#define SYS_KPROF_H
+
+// prints the kernel's slab caches and allocation profile to the serial console,
+// -1 if the kernel wasn't built with the profile
+int kprof_dump(void);
+
+#endif    // SYS_KPROF_H
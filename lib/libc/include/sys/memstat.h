@@ -0,0 +1,28 @@
+#ifndef SYS_MEMSTAT_H
+#define SYS_MEMSTAT_H
+
+#include <stdint.h>
+
+// memstat's result for a pid with no process, and for one past the end of the process table
+#define MEMSTAT_NOPROC -1
+#define MEMSTAT_END    -2
+
+// memory usage of a process, page counts are refreshed by the kernel once a second
+struct memstat
+{
+	int pid;
+	int parent;
+	int state;
+	char name[32];
+	uint32_t rss;        // resident user pages
+	uint32_t dirty;      // resident pages written to since they were brought in
+	uint32_t wss;        // pages touched in the last second
+	uint32_t faults;     // page faults resolved
+	uint32_t swapins;    // page faults that brought a page back from swap
+};
+
+// fills in buf for process pid, MEMSTAT_NOPROC if there is no such process
+// and MEMSTAT_END once pid is past the last process there can be
+int memstat(int pid, struct memstat *buf);
+
+#endif    // SYS_MEMSTAT_H
@@ -0,0 +1,31 @@
+#ifndef SYS_MMAN_H
+#define SYS_MMAN_H
+
+#include <stddef.h>
+
+// protection of a mapping
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+// type of a mapping
+#define MAP_SHARED    1
+#define MAP_PRIVATE   2
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_ANON      MAP_ANONYMOUS
+#define MAP_LARGE     0x40    // back an anonymous mapping with 4M pages, rounds it to 4M
+
+#define MAP_FAILED    ((void *) -1)
+
+// msync flags
+#define MS_ASYNC      1
+#define MS_INVALIDATE 2
+#define MS_SYNC       4
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, size_t off);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+
+#endif    // SYS_MMAN_H
@@ -25,6 +25,13 @@
 #define SYS_GETENV   9
 #define SYS_WAITPID  10
 #define SYS_IOCTL    11
+#define SYS_MMAP     12
+#define SYS_MUNMAP   13
+#define SYS_MSYNC    14
+#define SYS_KPROF    15
+#define SYS_MEMSTAT  16
+#define SYS_NICE     17
+#define SYS_YIELD    18
 
 int syscall(int, ...);
 
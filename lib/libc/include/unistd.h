@@ -25,5 +25,6 @@ int execve(const char*, char* const[], char* const[]);
 int execvp(const char*, char* const[]);
 pid_t fork();
 void *sbrk(intptr_t);
+int nice(int);
 
 #endif    // UNISTD_H
@@ -13,6 +13,7 @@
 
 #include <stddef.h>
 #include <string.h>
+#include <sys/mman.h>
 
 // rounds an number x up to the nearest multiple of 8
 #define round8(x) ((x + 7) & ~0x7);
@@ -45,6 +46,7 @@ static inline void deallocate_object(void *p);
 
 // Helper functions for allocating a block
 static inline header *allocate_object(size_t raw_size);
+static header *allocate_mapped(size_t raw_size);
 
 static void init();
 
@@ -292,6 +294,27 @@ static inline header *allocate_object(size_t size)
 	return (header *) block->data;	
 }
 
+/**
+ * @brief Helper to allocate a large object in its own anonymous mapping
+ *
+ * large objects would otherwise pin heap space that sbrk can never give back.
+ * a mapping is returned to the OS as soon as the object is freed.
+ *
+ * @param size number of bytes the user needs
+ * @return A pointer to the data region of the object
+ */
+static header *allocate_mapped(size_t size)
+{
+	size_t len = (size + ALLOC_HEADER_SIZE + 4095) & ~4095;
+	header *h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (h == MAP_FAILED)
+		return NULL;
+
+	set_block_size_and_state(h, len, MAPPED);
+	h->left_size = 0;
+	return (header *) h->data;
+}
+
 /**
  * @brief Helper to get the header from a pointer allocated with malloc
  * @param p pointer to the data region of the block
@@ -314,6 +337,13 @@ static inline void deallocate_object(void *p)
 	// header corresponding to the freeing address
 	struct header *h = (struct header *) (p - ALLOC_HEADER_SIZE);
 
+	// large objects live in their own mapping
+	if (get_block_state(h) == MAPPED)
+	{
+		munmap(h, get_block_size(h));
+		return;
+	}
+
 	// check for double free
 	if (get_block_state(h) != ALLOCATED)
 	{
@@ -431,6 +461,9 @@ void *malloc(size_t size)
 		initialized = true;
 	}
 
+	if (size >= MMAP_THRESHOLD)
+		return allocate_mapped(size);
+
 	header *hdr = allocate_object(size);
 	return hdr;
 }
@@ -443,7 +476,12 @@ void *calloc(size_t nmemb, size_t size)
 void *realloc(void *ptr, size_t size)
 {
 	void *mem = malloc(size);
-	memcpy(mem, ptr, size);
+	if (!ptr || !mem)
+		return mem;
+
+	// don't read past the end of the old object, it may be the end of a mapping
+	size_t old_size = get_block_size(ptr_to_header(ptr)) - ALLOC_HEADER_SIZE;
+	memcpy(mem, ptr, old_size < size ? old_size : size);
 	free(ptr);
 	return mem;
 }
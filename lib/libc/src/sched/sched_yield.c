@@ -0,0 +1,7 @@
+#include <sched.h>
+#include <syscall.h>
+
+int sched_yield(void)
+{
+	return syscall(SYS_YIELD);
+}
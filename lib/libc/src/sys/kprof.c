@@ -0,0 +1,7 @@
+#include <sys/kprof.h>
+#include <syscall.h>
+
+int kprof_dump(void)
+{
+	return syscall(SYS_KPROF);
+}
@@ -0,0 +1,7 @@
+#include <sys/memstat.h>
+#include <syscall.h>
+
+int memstat(int pid, struct memstat *buf)
+{
+	return syscall(SYS_MEMSTAT, pid, buf);
+}
@@ -0,0 +1,28 @@
+#include <sys/mman.h>
+#include <syscall.h>
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, size_t off)
+{
+	// mmap has more arguments than there are syscall registers, so they're passed in memory
+	struct
+	{
+		void *addr;
+		size_t len;
+		int prot;
+		int flags;
+		int fd;
+		size_t off;
+	} args = { addr, len, prot, flags, fd, off };
+
+	return (void *) syscall(SYS_MMAP, &args);
+}
+
+int munmap(void *addr, size_t len)
+{
+	return syscall(SYS_MUNMAP, addr, len);
+}
+
+int msync(void *addr, size_t len, int flags)
+{
+	return syscall(SYS_MSYNC, addr, len, flags);
+}
@@ -35,6 +35,8 @@ int syscall(int sysno, ...)
 	{
 		// syscalls with no arguments
 		case SYS_FORK:
+		case SYS_KPROF:
+		case SYS_YIELD:
 			ret = syscall0(sysno);
 			break;
 
@@ -43,6 +45,8 @@ int syscall(int sysno, ...)
 		case SYS_SBRK:
 		case SYS_CLOSE:
 		case SYS_GETENV:
+		case SYS_MMAP:
+		case SYS_NICE:
 			arg1 = va_arg(args, uint32_t);
 			ret = syscall1(sysno, arg1);
 			break;
@@ -50,6 +54,8 @@ int syscall(int sysno, ...)
 		// syscalls with 2 arguments
 		case SYS_EXECV:
 		case SYS_IOCTL:
+		case SYS_MUNMAP:
+		case SYS_MEMSTAT:
 			arg1 = va_arg(args, uint32_t);
 			arg2 = va_arg(args, uint32_t);
 			ret = syscall2(sysno, arg1, arg2);
@@ -61,6 +67,7 @@ int syscall(int sysno, ...)
 		case SYS_OPEN:
 		case SYS_GETDENTS:
 		case SYS_WAITPID:
+		case SYS_MSYNC:
 			arg1 = va_arg(args, uint32_t);
 			arg2 = va_arg(args, uint32_t);
 			arg3 = va_arg(args, uint32_t);
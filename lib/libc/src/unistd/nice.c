@@ -0,0 +1,7 @@
+#include <syscall.h>
+#include <unistd.h>
+
+int nice(int inc)
+{
+	return syscall(SYS_NICE, inc);
+}
@@ -0,0 +1,117 @@
+#! /bin/sh
+# maestro
+# License: GPLv2
+# See LICENSE.txt for full license text
+# Author: Sam Kravitz
+#
+# FILE: meta/kprof.sh
+# DATE: October 17th, 2026
+# DESCRIPTION: Resolves the call sites of a kernel allocation profile
+#
+# Reads serial console output (a file, or stdin) containing a dump from a kernel built
+# with make KMALLOC_PROFILE=1, and prints the profile lines with every return address
+# replaced by the function it's in, looked up in maestro.map. static functions aren't
+# in the map, so their addresses show up as an offset from the global function before
+# them, along with the object file they came from.
+#
+# usage: meta/kprof.sh [serial log]
+
+MAP=${MAP:-maestro.map}
+
+if [ ! -f "$MAP" ]; then
+	echo "kprof.sh: $MAP not found, build maestro first" >&2
+	exit 1
+fi
+
+awk '
+function hex(s,    i, n, c)
+{
+	n = 0
+	s = tolower(s)
+	sub(/^0x/, "", s)
+	for (i = 1; i <= length(s); i++)
+	{
+		c = index("0123456789abcdef", substr(s, i, 1))
+		if (c == 0)
+			break
+		n = n * 16 + c - 1
+	}
+	return n
+}
+
+function resolve(addr,    i, best, name, file)
+{
+	if (addr == 0)
+		return "-"
+
+	best = -1
+	for (i = 0; i < nsyms; i++)
+	{
+		if (sym_addr[i] <= addr && (best < 0 || sym_addr[i] > sym_addr[best]))
+			best = i
+	}
+
+	file = "?"
+	for (i = 0; i < nsecs; i++)
+	{
+		if (sec_addr[i] <= addr && addr < sec_addr[i] + sec_size[i])
+			file = sec_file[i]
+	}
+
+	name = best < 0 ? "?" : sprintf("%s+0x%x", sym_name[best], addr - sym_addr[best])
+	return name " (" file ")"
+}
+
+BEGIN {
+	nsyms = 0
+	nsecs = 0
+}
+
+# the map: text sections with the object they came from, and the global symbols in them
+FNR == NR {
+	if ($1 ~ /^\.text/ && NF == 1)
+	{
+		pending = 1
+		next
+	}
+
+	if (($1 ~ /^\.text/ && NF == 4 && $2 ~ /^0x/) || (pending && NF == 3 && $1 ~ /^0x/))
+	{
+		off = NF - 3
+		sec_addr[nsecs] = hex($(off + 1))
+		sec_size[nsecs] = hex($(off + 2))
+		sec_file[nsecs] = $(off + 3)
+		sub(/.*\//, "", sec_file[nsecs])
+		if (sec_size[nsecs] > 0)
+			nsecs++
+	}
+
+	else if (NF == 2 && $1 ~ /^0x/ && $2 ~ /^[A-Za-z_][A-Za-z0-9_]*$/)
+	{
+		sym_addr[nsyms] = hex($1)
+		sym_name[nsyms] = $2
+		nsyms++
+	}
+
+	pending = 0
+	next
+}
+
+/KMALLOC PROFILE/ {
+	sub(/.*KMALLOC PROFILE/, "KMALLOC PROFILE")
+	print
+	next
+}
+
+/\]: site 0x/ {
+	sub(/.*\]: site /, "")
+	print "site"
+	for (i = 1; i <= NF && $i ~ /^0x/; i++)
+		print "    " resolve(hex($i))
+
+	line = ""
+	for (; i <= NF; i++)
+		line = line " " $i
+	print "   " line
+}
+' "$MAP" "${1:--}"
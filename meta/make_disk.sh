@@ -11,3 +11,8 @@
 dd if=/dev/zero of=disk.img bs=1K count=64K
 mkfs.ext2 -I 128 -b 1024 -q disk.img
 e2mkdir disk.img:/bin
+
+# swap space for anonymous memory, written out in full so every page has blocks behind it
+dd if=/dev/zero of=swap.img bs=1K count=8K
+e2cp swap.img disk.img:/swap
+rm swap.img
@@ -0,0 +1,136 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: acpi.c
+ * DATE: October 18th, 2026
+ * DESCRIPTION: reading the firmware's ACPI tables
+ *
+ * Only the processors are of interest, so only the MADT is looked at. The tables usually
+ * live in memory the firmware keeps for itself, above what the direct map covers, so each
+ * one is mapped with ioremap for as long as it is being read.
+ */
+#include <acpi.h>
+
+#include <kprintf.h>
+#include <vmalloc.h>
+#include <vmm.h>
+
+#include <string.h>
+
+// physical address of the bios data area word holding the ebda's segment
+#define BDA_EBDA_SEGMENT 0x40e
+
+static bool checksum_ok(const void *p, size_t len)
+{
+	u8 sum = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += ((const u8 *) p)[i];
+
+	return sum == 0;
+}
+
+/**
+ * @brief looks for the rsdp in a range of low memory, it is always 16 byte aligned
+ * @return the rsdp, reached through the direct map, or NULL if it isn't there
+ */
+static struct acpi_rsdp *scan(uintptr_t phys, size_t len)
+{
+	for (uintptr_t p = phys; p + sizeof(struct acpi_rsdp) <= phys + len; p += 16)
+	{
+		struct acpi_rsdp *rsdp = phys_to_virt(p);
+		if (memcmp(rsdp->sig, "RSD PTR ", 8) == 0 && checksum_ok(rsdp, sizeof(struct acpi_rsdp)))
+			return rsdp;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief maps a whole table, checking it is the one wanted
+ * @param phys physical address of the table
+ * @param sig signature the table should have, or NULL for any
+ * @return the table, to be unmapped with iounmap, or NULL
+ */
+static struct acpi_sdt *map_table(uintptr_t phys, const char *sig)
+{
+	struct acpi_sdt *header = ioremap(phys, sizeof(struct acpi_sdt));
+	if (!header)
+		return NULL;
+
+	bool match = !sig || memcmp(header->sig, sig, 4) == 0;
+	u32 length = header->length;
+	iounmap(header);
+
+	if (!match || length < sizeof(struct acpi_sdt))
+		return NULL;
+
+	struct acpi_sdt *table = ioremap(phys, length);
+	if (table && !checksum_ok(table, length))
+	{
+		kprintf("acpi: bad checksum on %c%c%c%c table\n", table->sig[0], table->sig[1], table->sig[2], table->sig[3]);
+		iounmap(table);
+		return NULL;
+	}
+
+	return table;
+}
+
+/**
+ * @brief finds the processors listed in the MADT
+ * @param apic_ids set to the local apic id of every enabled processor, the boot cpu's among them
+ * @param max size of apic_ids
+ * @param lapic set to the physical address of the local apics
+ * @return the number of processors found, or -1 if there is no MADT
+ */
+int acpi_find_cpus(u8 *apic_ids, int max, uintptr_t *lapic)
+{
+	// the first kb of the extended bios data area, then the bios rom
+	uintptr_t ebda = *(u16 *) phys_to_virt(BDA_EBDA_SEGMENT) << 4;
+
+	struct acpi_rsdp *rsdp = ebda ? scan(ebda, 1024) : NULL;
+	if (!rsdp)
+		rsdp = scan(0xe0000, 0x20000);
+
+	if (!rsdp)
+		return -1;
+
+	struct acpi_sdt *rsdt = map_table(rsdp->rsdt, "RSDT");
+	if (!rsdt)
+		return -1;
+
+	struct acpi_madt *madt = NULL;
+	u32 *tables = (u32 *) (rsdt + 1);
+	int ntables = (rsdt->length - sizeof(struct acpi_sdt)) / sizeof(u32);
+
+	for (int i = 0; i < ntables && !madt; i++)
+		madt = (struct acpi_madt *) map_table(tables[i], "APIC");
+
+	iounmap(rsdt);
+
+	if (!madt)
+		return -1;
+
+	*lapic = madt->lapic;
+
+	int n = 0;
+	u8 *entry = madt->entries;
+	u8 *end = (u8 *) madt + madt->header.length;
+
+	while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end)
+	{
+		// processor id, apic id, flags
+		if (entry[0] == MADT_LAPIC && (*(u32 *) (entry + 4) & MADT_LAPIC_ENABLED) && n < max)
+			apic_ids[n++] = entry[3];
+
+		// the 32 bit field can't hold an address above 4G, which we couldn't use anyway
+		else if (entry[0] == MADT_LAPIC_OVERRIDE && *(u32 *) (entry + 8) == 0)
+			*lapic = *(u32 *) (entry + 4);
+
+		entry += entry[1];
+	}
+
+	iounmap(madt);
+	return n;
+}
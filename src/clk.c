@@ -6,25 +6,52 @@
  * FILE: clk.c
  * DATE: August 2nd, 2021
  * DESCRIPTION: Controllers for the PIT
+ *
+ * The clock doesn't tick at a fixed rate. The PIT is used one-shot, programmed each time
+ * for when the kernel next needs it: the next timer on the wheel, or the end of the
+ * running process's quantum. An idle cpu only wakes up for timers, and at most every
+ * PIT_MAX_MS since that is as far as the 16 bit counter reaches. Time is kept by reading
+ * back how far the counter has got, so uptime is right whenever the interrupt comes.
+ *
+ * The PIT only interrupts the boot cpu. Once the local apic timers have been measured
+ * every cpu keeps track of its own quantum with its own timer, and the PIT is left with
+ * the timer wheel.
  */
 #include <clk.h>
 
 #include <intr.h>
 #include <io.h>
 #include <kprintf.h>
+#include <lapic.h>
 #include <proc.h>
-#include <pq.h>
-#include <queue.h>
+#include <smp.h>
+#include <timer.h>
+#include <vmm.h>
 
 // base frequency of the PIT, in Hz
 #define PIT_BASE_RATE 1193180
 
+// PIT counts in a ms
+#define PIT_PER_MS (PIT_BASE_RATE / 1000)
+
+// longest the PIT can be programmed for
+#define PIT_MAX_MS (0xffff / PIT_PER_MS)
+
+// PIT read back status bits
+#define PIT_OUT        0x80    // the count has reached 0
+#define PIT_NULL_COUNT 0x40    // a new count hasn't been loaded into the counter yet
+
 static u64 sec = 0;    // seconds since maestro was bootstrapped
 static int ms  = 0;    // ms since sec was last updated
 
-extern struct queue *readyq;
-extern struct pq *sleepq;
-extern struct proc *curr;
+static u32 shot;       // counts the PIT was last programmed for
+static u32 seen;       // counts of the current shot already added to the clock
+static u32 frac;       // counts added to the clock that don't make up a whole ms yet
+static u32 shot_end;   // uptime the current shot ends at
+
+// second vmm_scan_usage last ran in
+static u64 scanned;
+
 
 /**
  * @brief total number of ms since maestro was bootstrapped
@@ -34,48 +61,211 @@ static inline u32 timestamp()
 	return sec * 1000 + ms;
 }
 
-static int sleep_cmp(void *p1, void *p2)
+/**
+ * @brief counts since the PIT was last programmed
+ * in one-shot mode the counter keeps going past 0 and wraps around to 0xffff,
+ * so a shot that is handled late is still measured right
+ */
+static u32 pit_elapsed()
 {
-	struct proc *pptr1 = (struct proc *) p1;
-	struct proc *pptr2 = (struct proc *) p2;
-	return pptr1->wakeup < pptr2->wakeup;
+	// latch the status and count of channel 0 together
+	outb(0x43, 0xc2);
+	u8 status = inb(0x40);
+	u16 count = inb(0x40);
+	count |= inb(0x40) << 8;
+
+	if (status & PIT_NULL_COUNT)
+		return seen;
+
+	if (status & PIT_OUT)
+		return shot + ((0x10000 - count) & 0xffff);
+
+	return shot - count;
 }
 
-static void clkhandler()
+/**
+ * @brief adds the time that has gone by in the current shot to the clock
+ */
+static void clk_sync()
 {
-	// wake up sleeping process if necessary
-	struct proc *pptr = (struct proc *) peek(&sleepq);
-	if (pptr && pptr->wakeup <= timestamp())
+	int mask = disable();
+
+	u32 done = pit_elapsed();
+	if (done > seen)
 	{
-		pop(&sleepq);
-		pptr->state = PR_READY;
-		pptr->wakeup = 0;
-		insert(readyq, pptr);
+		frac += done - seen;
+		seen = done;
+
+		u32 n = frac / PIT_PER_MS;
+		frac %= PIT_PER_MS;
+
+		ms += n;
+		while (ms >= 1000)
+		{
+			++sec;
+			ms -= 1000;
+		}
 	}
 
-	if (++ms == 1000)
+	restore(mask);
+}
+
+/**
+ * @brief starts a new shot
+ * @param n ms until the interrupt, 1 to PIT_MAX_MS
+ */
+static void pit_load(u32 n)
+{
+	shot = n * PIT_PER_MS;
+	seen = 0;
+	shot_end = timestamp() + n;
+
+	// channel 0, low byte then high byte, mode 0 (interrupt on terminal count)
+	outb(0x43, 0x30);
+	outb(0x40, shot >> 0 & 0xFF);
+	outb(0x40, shot >> 8 & 0xFF);
+}
+
+/**
+ * @brief takes the time that has gone by on this cpu since the last call, to charge to the running process
+ * @return ms since the last call
+ */
+u32 clk_take()
+{
+	int mask = disable();
+
+	struct cpu *c = this_cpu();
+	u32 now = uptime();
+	u32 n = now - c->charged_at;
+	c->charged_at = now;
+
+	restore(mask);
+	return n;
+}
+
+/**
+ * @brief programs the PIT for the next time the kernel needs it
+ * that is the next timer on the wheel, and the end of curr's quantum too
+ * if there is no local apic timer to take care of it
+ */
+static void pit_rearm()
+{
+	clk_sync();
+	u32 now = timestamp();
+
+	// whatever is already due is handled at the next interrupt
+	s32 n = timer_next(now + PIT_MAX_MS) - now;
+	if (n < 1)
+		n = 1;
+
+	if (!lapic_timer_ready())
 	{
-		++sec;
-		ms = 0;
-		sched();
+		u32 quantum = sched_next();
+		if (quantum < (u32) n)
+			n = quantum ? quantum : 1;
 	}
+
+	pit_load(n);
+}
+
+/**
+ * @brief programs the clock for the end of curr's quantum, called whenever curr changes
+ */
+void clk_rearm()
+{
+	int mask = disable();
+
+	if (!lapic_timer_arm(sched_next()))
+		pit_rearm();
+
+	restore(mask);
+}
+
+/**
+ * @brief makes sure the clock interrupts no later than a given time
+ * @param when uptime the kernel has to run at, for a timer that was just added
+ */
+void clk_wake_by(u32 when)
+{
+	int mask = disable();
+
+	if ((s32) (when - shot_end) < 0)
+		pit_rearm();
+
+	restore(mask);
+}
+
+/**
+ * @brief busy waits, for hardware that has to be given time
+ * it works with interrupts off, which they are during init
+ * @param msec number of milliseconds to wait
+ */
+void clk_delay(u32 msec)
+{
+	int mask = disable();
+
+	while (msec > 0)
+	{
+		u32 n = msec < PIT_MAX_MS ? msec : PIT_MAX_MS;
+
+		// the PIT is reprogrammed for the wait, so the time of the shot it cuts short goes on the clock first
+		clk_sync();
+		pit_load(n);
+
+		while (pit_elapsed() < shot)
+			asm volatile("pause");
+
+		msec -= n;
+	}
+
+	clk_sync();
+	restore(mask);
+}
+
+static void clkhandler()
+{
+	u32 n = clk_take();
+
+	if (sec != scanned)
+	{
+		scanned = sec;
+		vmm_scan_usage();
+	}
+
+	// wakes up every process whose sleep is over
+	timer_tick(timestamp());
+
+	// the next shot has to be set up before sched_tick, if it switches processes this
+	// only runs again once the one it preempted is back, and the clock would stop until then
+	pit_rearm();
+
+	sched_tick(n);
+
+	// curr's quantum has been charged since, so the shot is set up again for what is left of it
+	if (!lapic_timer_ready())
+		pit_rearm();
+}
+
+// this cpu's local apic timer, the running process's quantum is up
+static void lapic_tick()
+{
+	sched_tick(clk_take());
+	clk_rearm();
 }
 
 // init clk
 void clk_init()
 {
 	set_vect(IRQ0, clkhandler);
+	set_vect(LAPIC_TIMER, lapic_tick);
 
-	// we want our clock interrupt to trigger at a rate of 1000Hz,
-	// or once every 1ms. Hence we divide by 1000.
-	u32 divisor = PIT_BASE_RATE / 1000;
-
-	// Send the command byte.
-	outb(0x43, 0x36);
+	// the timer wheel isn't up yet, the first interrupt programs the PIT properly
+	pit_load(1);
+}
 
-	// Send the frequency divisor.
-	outb(0x40, divisor >> 0 & 0xFF);
-	outb(0x40, divisor >> 8 & 0xFF);
+static void wake_sleeper(void *arg)
+{
+	ready((struct proc *) arg);
 }
 
 /**
@@ -85,10 +275,18 @@ void clk_init()
 void sleepms(uint msec)
 {
 	int mask = disable();
-	u32 wakeup = timestamp() + msec;
-	curr->wakeup = wakeup;
-	push(&sleepq, curr, sleep_cmp);
+	timer_setup(&curr->sleep_timer, wake_sleeper, curr);
+	timer_add(&curr->sleep_timer, msec);
 	curr->state = PR_SLEEPING;
 	sched();
 	restore(mask);
 }
+
+/**
+ * @brief number of ms since maestro was bootstrapped
+ */
+u32 uptime()
+{
+	clk_sync();
+	return timestamp();
+}
@@ -16,12 +16,88 @@
 #include <pmm.h>
 #include <proc.h>
 #include <vfs.h>
+#include <vma.h>
 #include <vmm.h>
 
-extern struct proc *curr;
+#include <string.h>
+
 
 extern void enter_usermode(void *, void *);
 
+/**
+ * @brief sets up a process's user address space for an elf file
+ *
+ * only the elf and program headers are read here. each loadable segment becomes a
+ * file backed area, and the heap and stack become anonymous areas, so their pages are
+ * read or zero filled by vmm_page_fault when they are first touched.
+ *
+ * @param pptr process whose address space is being set up
+ * @param inode inode of the elf file
+ * @return entry point of the program, or 0 if the file is not a valid elf file or memory ran out
+ */
+uintptr_t elf_load(struct proc *pptr, u32 inode)
+{
+	struct elf_ehdr ehdr;
+	ext2_read_data(&ehdr, inode, 0, sizeof(ehdr));
+
+	if (ehdr.e_ident[0] != 0x7f || ehdr.e_ident[1] != 'E' || ehdr.e_ident[2] != 'L' || ehdr.e_ident[3] != 'F')
+		return 0;
+
+	// the heap starts on the first page after the highest segment
+	uintptr_t brk = 0;
+
+	for (uint i = 0; i < ehdr.e_phnum; i++)
+	{
+		struct elf_phdr phdr;
+		ext2_read_data(&phdr, inode, ehdr.e_phoff + i * sizeof(phdr), sizeof(phdr));
+
+		if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0)
+			continue;
+
+		// areas are page granular, so a segment that doesn't start on a page boundary
+		// also takes the file bytes in front of it
+		u32 lead = phdr.p_vaddr % PAGE_SIZE;
+		uintptr_t start = phdr.p_vaddr - lead;
+		uintptr_t end = BLOCK_ALIGN(phdr.p_vaddr + phdr.p_memsz);
+		unsigned flags = phdr.p_flags & PF_W ? VMA_WRITE : 0;
+
+		vma_map(&pptr->vmas, start, end, flags, inode, phdr.p_offset - lead, phdr.p_filesz + lead);
+
+		if (end > brk)
+			brk = end;
+	}
+
+	pptr->sbrk = (void *) brk;
+
+	// stack grows down from the argv/envp page at the very top of user space
+	vma_map(&pptr->vmas, KERNEL_BASE - USTACK_SIZE, KERNEL_BASE, VMA_WRITE, 0, 0, 0);
+
+	// the argv/envp page and the first stack page are written before the program even starts,
+	// so map them up front in one go instead of taking a fault on each
+	uintptr_t frames[2];
+	for (int i = 0; i < 2; i++)
+	{
+		frames[i] = pmm_alloc_zeroed();
+		if (!frames[i])
+		{
+			// they'll just be faulted in later instead
+			if (i)
+				pmm_unref(frames[0]);
+			return ehdr.e_entry;
+		}
+	}
+
+	if (vmm_map_range(pptr->pdir, frames, KERNEL_BASE - 2 * PAGE_SIZE, 2, PT_PRESENT | PT_WRITABLE | PT_USER) < 0)
+	{
+		pmm_unref(frames[0]);
+		pmm_unref(frames[1]);
+		kprintf("elf_load: out of memory for the stack's page table\n");
+		return 0;
+	}
+
+	return ehdr.e_entry;
+}
+
 /**
  * @brief reads, loads, and runs an elf file
  * this function is not called directly, but the starting point
@@ -30,13 +106,8 @@ extern void enter_usermode(void *, void *);
 void run_elf()
 {
 	int fd = vfs_open(curr->name);
-	int inode = curr->ofile[fd]->n->inode;
-	size_t s = ext2_filesize(inode);
-	u8 *buff = kmalloc(s);
-	ext2_read_data(buff, inode, 0, s);
-
-	struct elf_ehdr *ehdr = (struct elf_ehdr *) buff;
-	print_elf(ehdr);
+	u32 inode = curr->ofile[fd]->n->inode;
+	vfs_close(fd);
 
 	// Create a new address space for this process
 	uintptr_t user_pdir = vmm_create_address_space();
@@ -48,33 +119,18 @@ void run_elf()
 
 	// Store the page directory physical address in the process structure
 	curr->pdir = user_pdir;
+	curr->vmas = NULL;
 
-    struct elf_phdr *phdr_table = (struct elf_phdr *) (buff + ehdr->e_phoff);
-	struct elf_phdr *phdr;
-
-	phdr = &phdr_table[0];
-	for (uint i = 0; i < ehdr->e_phnum; i++)
+	uintptr_t entry = elf_load(curr, inode);
+	if (!entry)
 	{
-		phdr = &phdr_table[i];
-        for (unsigned j = 0; j <= phdr->p_memsz / PAGE_SIZE; j++)
-        {
-            uintptr_t phys = pmm_alloc();
-            vmm_map_page_in_pdir(curr->pdir, phys, phdr->p_vaddr + j * PAGE_SIZE, PT_PRESENT | PT_WRITABLE | PT_USER);
-        }
+		kprintf("%s is not an elf file\n", curr->name);
+		proc_exit(1);
 	}
 
-    // Switch to the process's page directory to copy data into user space
+    // Switch to the process's page directory so its pages fault in as we touch them
     asm("mov %0, %%cr3" :: "r"(curr->pdir) : "memory");
 
-    // Now copy ELF segments into user space
-    for (uint i = 0; i < ehdr->e_phnum; i++)
-    {
-        phdr = &phdr_table[i];
-        memcpy((void *) phdr->p_vaddr, &buff[phdr->p_offset], phdr->p_memsz);
-    }
-
-    kfree(buff);
-
     const char *argv[] = {
         "ls",
         "-lia",
@@ -87,10 +143,8 @@ void run_elf()
         NULL,
     };
 
-    // allocate a page for argv/envp data
+    // the top page of the stack area holds argv/envp data
     void *data_page = (void *) (0xc0000000 - PR_STACKSIZE);
-    uintptr_t data_phys = pmm_alloc();
-    vmm_map_page_in_pdir(curr->pdir, data_phys, (uintptr_t) data_page, PT_PRESENT | PT_WRITABLE | PT_USER);
 
     // Store pointer to user stack data for syscalls like getenv
     curr->ustack = data_page;
@@ -135,9 +189,7 @@ void run_elf()
     argv_ptrs[argc] = NULL;
 
 
-    // Create user stack and map it
-    uintptr_t ustack_phys = pmm_alloc();
-    vmm_map_page_in_pdir(curr->pdir, ustack_phys, 0xc0000000 - 2 * PR_STACKSIZE, PT_PRESENT | PT_WRITABLE | PT_USER);
+    // user stack starts right below the argv/envp page
     u32 *ustack = (u32*) (0xc0000000 - PR_STACKSIZE);
 
     // Place envp, argv, and argc on the stack
@@ -146,7 +198,7 @@ void run_elf()
     --ustack; *ustack = (uintptr_t) argv_ptrs;  // Push second
     --ustack; *ustack = argc;                    // Push last (ESP points here)
 
-    enter_usermode(ustack, (void *) ehdr->e_entry);
+    enter_usermode(ustack, (void *) entry);
 }
 
 void print_elf(struct elf_ehdr *ehdr)
@@ -9,9 +9,13 @@
 [bits 32]
 
 	global enter_usermode
+	extern klock_release
 
 ; cdecl - void enter_usermode(void *ustack, void *_start)
+; called with interrupts off, user code runs with them on
 enter_usermode:
+	call klock_release     ; so the kernel lock goes too (see smp.h)
+
 	mov ax, 20h | 3    ; ring 3 data with bottom 2 bits set for ring 3
 	mov ds, ax
 	mov es, ax 
@@ -24,6 +28,7 @@ enter_usermode:
 	push 20h | 3           ; user mode data selector
 	push eax               ; current esp
 	pushf                  ; eflags
+	or dword [esp], 200h   ; with interrupts enabled
 	push 18h | 3           ; user mode code selector
 	push ecx               ; return address (start of user process)
 	iret
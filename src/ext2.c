@@ -10,8 +10,10 @@
 #include <ext2.h>
 
 #include <ata.h>
+#include <bitmap.h>
 #include <kmalloc.h>
 #include <kprintf.h>
+#include <vmalloc.h>
 
 #include <string.h>
 
@@ -23,8 +25,12 @@ struct block_group_desc *bgdt;
 // number of block groups in volume
 static int block_groups;
 
+// number of blocks the bgdt takes up on disk, the in memory copy is this many blocks long too
+static u32 bgdt_blocks;
+
 static int alloc_inode();
 static int alloc_block();
+static void load_bitmap(struct sbitmap *, u32, int);
 static struct inode_t read_inode(u32);
 static void write_inode(struct inode_t *, u32);
 static void print_inode(u32);
@@ -34,65 +40,19 @@ static u32 *get_data_blocks(struct inode_t *, u32, u32);
 
 static bool insert_dirent(struct inode_t *, struct ext2_dir_entry *, char *);
 
-#define BITMAP_SET(bitmap, bit)   (bitmap[bit / 8] |=  (1 << (bit % 8)))
-#define BITMAP_CLEAR(bitmap, bit) (bitmap[bit / 8] &= ~(1 << (bit % 8)))
-
-static int BITMAP_TEST(u8 *bitmap, int bit)
-{
-	return bitmap[bit / 8] & (1 << (bit % 8)) ? 1 : 0;
-}
-
-/**
- * @brief finds the first set bit of a bitmap
- * @param bitmap a pointer to the bitmap
- * @param max_bits the maximum bit index this bitmap keeps track of
- * @return index of first set bit or -1 if all are clear
- */
-static inline int BITMAP_FIRST_SET(u8 *bitmap, int max_bits)
-{
-	for (int i = 0; i < max_bits / 8; ++i)
-	{
-		// quickly check if all 8 bits of this u8 are clear to save some work
-		if (bitmap[i] == 0)
-			continue;
-
-		// at least one of the bits in this u8 are set so find it
-		for (int j = 0; j < 8; ++j)
-		{
-			int bit = i * 8 + j;
-			if (BITMAP_TEST(bitmap, bit))
-				return bit;
-		}
-	}
-
-	return -1;
-}
-
 /**
- * @brief finds the first clear bit of a bitmap
- * @param bitmap a pointer to the bitmap
- * @param max_bits the maximum bit index this bitmap keeps track of
- * @return index of first clear bit or -1 if all are set
+ * in-memory copies of a block group's block and inode bitmaps
+ * every allocation used to read the bitmap block from disk and walk it a byte at a time.
+ * keeping them cached with a summary level lets alloc_block/alloc_inode find a free bit
+ * with a handful of word operations, and only the write back touches the disk.
  */
-static inline int BITMAP_FIRST_CLEAR(u8 *bitmap, int max_bits)
+struct group_bitmaps
 {
-	for (int i = 0; i < max_bits / 8; ++i)
-	{
-		// quickly check if all 8 bits of this u8 are set to save us some work
-		if (bitmap[i] == 0xff)
-			continue;
+	struct sbitmap blocks;
+	struct sbitmap inodes;
+};
 
-		// at least one of the bits in this u8 are clear so find it
-		for (int j = 0; j < 8; ++j)
-		{
-			int bit = i * 8 + j;
-			if (!BITMAP_TEST(bitmap, bit))
-				return bit;
-		}
-	}
-
-	return -1;
-}
+static struct group_bitmaps *group_maps;
 
 /**
  * reads ext2 filesystem block(s) from disk
@@ -121,7 +81,7 @@ static inline void write_block(void *buff, uint blk, int n)
  */
 static inline void write_bgdt()
 {
-	write_block(bgdt, EXT2_BLOCK_DESCRIPTOR, get_num_blocks(block_groups * sizeof(struct block_group_desc)));
+	write_block(bgdt, EXT2_BLOCK_DESCRIPTOR, bgdt_blocks);
 }
 
 /**
@@ -163,20 +123,24 @@ void ext2_init()
 	/*
      * read the block group descriptor table into memory
      * the size of the bgdt is not constant, and does not have to be a multiple of BLOCK_SIZE.
-	 * allocate the exact amount of bytes the bgdt requires and then
-	 * keep a sepparate buffer which is the closest multiple of BLOCK_SIZE.
-	 * then, read an entire BLOCK_SIZE multiple into the buffer and copy only
-	 * what is needed to the bgdt
+	 * allocate the closest multiple of BLOCK_SIZE so whole blocks can be read
+	 * straight into it, and written straight back out by write_bgdt
 	 */
 	size_t bgdt_size = sizeof(struct block_group_desc) * block_groups;
-	bgdt = kmalloc(bgdt_size);
-	u8 bgdt_blocks = get_num_blocks(bgdt_size);
+	bgdt_blocks = get_num_blocks(bgdt_size);
 	if (bgdt_size % EXT2_BLOCK_SIZE != 0)
 		bgdt_blocks++;
-	
-	u8 buff[bgdt_blocks * EXT2_BLOCK_SIZE];
-	read_block(buff, EXT2_BLOCK_DESCRIPTOR, bgdt_blocks);
-	memcpy(bgdt, buff, bgdt_size);
+
+	bgdt = kvmalloc(bgdt_blocks * EXT2_BLOCK_SIZE);
+	read_block(bgdt, EXT2_BLOCK_DESCRIPTOR, bgdt_blocks);
+
+	// cache every group's bitmaps
+	group_maps = kvmalloc(sizeof(struct group_bitmaps) * block_groups);
+	for (int i = 0; i < block_groups; i++)
+	{
+		load_bitmap(&group_maps[i].blocks, bgdt[i].block_bitmap, superblock.blocks_per_group);
+		load_bitmap(&group_maps[i].inodes, bgdt[i].inode_bitmap, superblock.inodes_per_group);
+	}
 
 	(void) print_inode;
 	(void) print_superblock;
@@ -235,10 +199,9 @@ static int alloc_inode()
 			continue;
 
 		// get this group's inode bitmap
-		u8 buff[EXT2_BLOCK_SIZE];
-		read_block(buff, bgd->inode_bitmap, 1);
+		struct sbitmap *bitmap = &group_maps[i].inodes;
 
-		int index = BITMAP_FIRST_CLEAR(buff, superblock.inodes_per_group);
+		int index = sbitmap_first_clear(bitmap);
 
 		// no free inode could be found
 		if (index == -1)
@@ -246,13 +209,13 @@ static int alloc_inode()
 
 		bgd->free_inode_count--;
 		superblock.free_inode_count--;
-		BITMAP_SET(buff, index);
-		write_block(buff, bgd->inode_bitmap, 1);
+		sbitmap_set(bitmap, index);
+		write_block(bitmap->map, bgd->inode_bitmap, 1);
 		write_bgdt();
 		write_superblock();
 
 		// inode indeces start at 1, so add 1 bc bitmaps start at 0
-		return index + 1;
+		return i * superblock.inodes_per_group + index + 1;
 	}
 
 	// should never get here
@@ -278,10 +241,9 @@ static int alloc_block()
 			continue;
 
 		// get this group's block bitmap
-		u8 buff[EXT2_BLOCK_SIZE];
-		read_block(buff, bgd->block_bitmap, 1);
+		struct sbitmap *bitmap = &group_maps[i].blocks;
 
-		int index = BITMAP_FIRST_CLEAR(buff, superblock.blocks_per_group);
+		int index = sbitmap_first_clear(bitmap);
 
 		// no free inode could be found
 		if (index == -1)
@@ -289,12 +251,13 @@ static int alloc_block()
 
 		bgd->free_block_count--;
 		superblock.free_block_count--;
-		BITMAP_SET(buff, index);
-		write_block(buff, bgd->block_bitmap, 1);
+		sbitmap_set(bitmap, index);
+		write_block(bitmap->map, bgd->block_bitmap, 1);
 		write_bgdt();
 		write_superblock();
 
-		return index;
+		// bit 0 of each group's bitmap is the group's first block
+		return i * superblock.blocks_per_group + superblock.first_data_block + index;
 	}
 
 	// should never get here
@@ -302,6 +265,22 @@ static int alloc_block()
 	return EXT2_ALLOC_ERROR;
 }
 
+/**
+ * @brief reads a bitmap block from disk into a cached summary bitmap
+ * @param sb bitmap to initialize
+ * @param blk block id of the on-disk bitmap
+ * @param nbits number of items the bitmap keeps track of
+ */
+static void load_bitmap(struct sbitmap *sb, u32 blk, int nbits)
+{
+	// on-disk bitmaps are always a whole block, even if the group tracks fewer items
+	u32 *map = kmalloc(EXT2_BLOCK_SIZE);
+	u32 *summary = kmalloc(SBITMAP_SUMMARY_WORDS(nbits) * sizeof(u32));
+
+	read_block(map, blk, 1);
+	sbitmap_init(sb, map, summary, nbits);
+}
+
 /**
  * @brief retrieves a given inode
  * @param idx index of the inode to get
@@ -508,6 +487,19 @@ size_t ext2_filesize(u32 inum)
 	return inode.size;
 }
 
+/**
+ * @brief gets the disk blocks holding part of a file
+ * @param inum inode number
+ * @param start first data block of the file
+ * @param count number of data blocks
+ * @return array of block numbers, allocated with kvmalloc
+ */
+u32 *ext2_data_blocks(u32 inum, u32 start, u32 count)
+{
+	struct inode_t inode = read_inode(inum);
+	return get_data_blocks(&inode, start, count);
+}
+
 /**
  * @brief read from a file's data blocks
  * @param buff buffer to read data into
@@ -537,7 +529,8 @@ int ext2_read_data(void *buff, u32 inum, size_t off, size_t count)
 		num_blocks++;
 
 	// list of data blocks to read
-	u32 *data_blocks = get_data_blocks(&inode, start_block, num_blocks);
+	u32 *blocks = get_data_blocks(&inode, start_block, num_blocks);
+	u32 *data_blocks = blocks;
 
 	// temporary buffer if reading from a non block-aligned offset
 	u8 tmp[EXT2_BLOCK_SIZE];
@@ -571,20 +564,71 @@ int ext2_read_data(void *buff, u32 inum, size_t off, size_t count)
 		read_block(tmp, *data_blocks, 1);
 		memcpy(buff, tmp, remaining);
 	}
-	
+
+	kvfree(blocks);
 	return count;
 }
+
 /**
  * @brief write into a file's data blocks
- * @param buff buffer to write data into
- * @param inum inode number to write from
+ *
+ * data is written in place, so only bytes inside the file's current size are
+ * written. blocks that are only partially covered are read, patched, and written back.
+ *
+ * @param buff buffer holding the data to write
+ * @param inum inode number to write to
  * @param off  byte offset in file to begin writing
  * @param count number of bytes to write
- * @return number of bytes 
+ * @return number of bytes written
  */
 int ext2_write_data(void *buff, u32 inum, size_t off, size_t count)
 {
-	return 1;
+	struct inode_t inode = read_inode(inum);
+
+	if (off >= inode.size)
+		return 0;
+
+	if (count > inode.size - off)
+		count = inode.size - off;
+
+	if (count == 0)
+		return 0;
+
+	u32 start_block = off / EXT2_BLOCK_SIZE;
+	u32 end_block = (off + count - 1) / EXT2_BLOCK_SIZE;
+	u32 *blocks = get_data_blocks(&inode, start_block, end_block - start_block + 1);
+
+	u8 tmp[EXT2_BLOCK_SIZE];
+	u8 *src = buff;
+	size_t remaining = count;
+	u32 block_off = off % EXT2_BLOCK_SIZE;
+
+	for (u32 i = 0; remaining; i++)
+	{
+		size_t n = EXT2_BLOCK_SIZE - block_off;
+		if (n > remaining)
+			n = remaining;
+
+		// whole blocks go straight to disk, partial ones have to keep the bytes around them
+		if (n == EXT2_BLOCK_SIZE)
+		{
+			write_block(src, blocks[i], 1);
+		}
+
+		else
+		{
+			read_block(tmp, blocks[i], 1);
+			memcpy(tmp + block_off, src, n);
+			write_block(tmp, blocks[i], 1);
+		}
+
+		src += n;
+		remaining -= n;
+		block_off = 0;
+	}
+
+	kvfree(blocks);
+	return count;
 }
 
 /**
@@ -600,7 +644,7 @@ int ext2_write_data(void *buff, u32 inum, size_t off, size_t count)
  */
 static u32 *get_data_blocks(struct inode_t *in, u32 start, u32 count)
 {
-	u32 *blocks = kmalloc(sizeof(u32) * count);
+	u32 *blocks = kvmalloc(sizeof(u32) * count);
 
 	// buffers to hold the indirect block pointers, if necessary
 	u32 singly[EXT2_BLOCK_SIZE / sizeof(u32)];
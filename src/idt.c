@@ -17,7 +17,6 @@
 struct idt_entry idt[256];
 
 static void set_idt(int, u32, u16, u8);
-static void lidt();
 
 struct idtr
 {
@@ -44,11 +43,18 @@ void idt_init()
 	// set syscall entry in idt
 	set_idt(48, (u32) ivect[48], 0x8, 0xee);
 
-	lidt();
+	// set local apic entries in idt, only the vectors in use have a stub
+	for (int i = 49; i < 64; ++i)
+	{
+		if (ivect[i])
+			set_idt(i, (u32) ivect[i], 0x8, 0x8e);
+	}
+
+	idt_load();
 }
 
-// stores idt structure in idtr
-static void lidt()
+// stores idt structure in idtr, every cpu loads the same one
+void idt_load()
 {
 	idtr.limit = sizeof(idt) - 1;
 	idtr.base  = (u32) &idt;
@@ -18,10 +18,14 @@
 #include <pmm.h>
 #include <proc.h>
 #include <sem.h>
+#include <smp.h>
+#include <swap.h>
+#include <timer.h>
 #include <tty.h>
 #include <vfs.h>
 #include <vmm.h>
 #include <w.h>
+#include <zram.h>
 
 // initializes IDT, interrupts, and the clock
 void init()
@@ -31,16 +35,22 @@ void init()
 	clk_init();
 	pmm_init();
 	vmm_init();
+	timer_init();
 	sem_init();
 	tty_init();
 	//w_init();
 
 	ext2_init();
 	vfs_init();
+	swap_init();
+	zram_init();
 
 	proc_init();
 	//mouse_init();
 
 	// set keyboard interrupt handler
 	set_vect(IRQ1, kbdhandler);
+
+	// last, the other cpus start scheduling processes as soon as interrupts go on
+	smp_init();
 }
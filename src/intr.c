@@ -12,17 +12,21 @@
 #include <intr.h>
 #include <io.h>
 #include <kprintf.h>
+#include <lapic.h>
 #include <maestro.h>
+#include <smp.h>
 #include <syscall.h>
 #include <proc.h>
+#include <vmm.h>
 
-extern struct proc *curr;
 extern void stack_trace(u32 start_ebp);
 
 #define PIC1 0x20    // pic1 command port
 #define PIC2 0xa0    // pic2 command port
 #define EOI  0x20    // end of interrupt value
 
+#define EFLAGS_IF 0x200    // interrupts are enabled
+
 // user registered interrupt handlers
 // defined in intr.s
 extern void (*user_handlers[])(void);
@@ -67,6 +71,61 @@ static const char *xint_msg[] = {
 	"reserved",
 };
 
+static inline u32 read_eflags()
+{
+	u32 eflags;
+	asm volatile("pushf; pop %0" : "=r"(eflags));
+	return eflags;
+}
+
+/**
+ * @brief locally disables interrupts, taking the kernel lock if they were on (see smp.h)
+ * @return the interrupt state to hand back to restore
+ */
+int disable()
+{
+	u32 eflags = read_eflags();
+	asm volatile("cli" ::: "memory");
+
+	if (eflags & EFLAGS_IF)
+		klock_acquire();
+
+	return eflags & EFLAGS_IF;
+}
+
+/**
+ * @brief puts interrupts back to the state they were in when disable() was called
+ * the kernel lock is given up when they go back on
+ * @param mask return value of disable()
+ */
+void restore(int mask)
+{
+	if ((mask & EFLAGS_IF) && !(read_eflags() & EFLAGS_IF))
+	{
+		klock_release();
+		asm volatile("sti" ::: "memory");
+	}
+}
+
+/**
+ * @brief turns interrupts on, giving up the kernel lock
+ */
+void enable()
+{
+	restore(EFLAGS_IF);
+}
+
+/**
+ * @brief turns interrupts on and waits for the next one, called with interrupts off
+ * sti takes effect after the instruction following it, so nothing that comes in
+ * between can leave the cpu waiting for the interrupt after it
+ */
+void halt()
+{
+	klock_release();
+	asm volatile("sti; hlt" ::: "memory");
+}
+
 /**
  * @brief high level interrupt handler
  * common assembly code in intr.s bootstraps the handler
@@ -79,6 +138,13 @@ void isr(struct registers *regs)
 	int mask = disable();
 	u8 intr  = regs->intr_num;
 
+	// page faults the vmm can resolve (e.g. copy-on-write) are not errors
+	if (intr == 14 && vmm_page_fault(regs))
+	{
+		restore(mask);
+		return;
+	}
+
 	// exception
 	if (intr < IRQ0)
 	{
@@ -124,18 +190,35 @@ void isr(struct registers *regs)
 		handler(regs);
 	}
 
+	// the local apic doesn't wait for an eoi on a spurious interrupt, and there's nothing to handle
+	else if (intr == LAPIC_SPURIOUS)
+	{
+		restore(mask);
+		return;
+	}
+
 	// irq
 	else
 	{
-		// call registered handler on irq
-		void (*handler)(void) = user_handlers[intr];
-		handler();
+		// acknowledge interrupt with eoi before the handler runs,
+		// the clock handler may switch to another process and not come back here for a while
+		if (intr <= IRQ15)
+		{
+			outb(PIC1, EOI);
+
+			if (intr >= IRQ8)
+				outb(PIC2, EOI);
+		}
 
-		// acknowledge interrupt with eoi
-		outb(PIC1, EOI);
+		else
+		{
+			lapic_eoi();
+		}
 
-		if (intr > IRQ8)
-			outb(PIC2, EOI);
+		// call registered handler on irq
+		void (*handler)(void) = user_handlers[intr];
+		if (handler)
+			handler();
 	}
 
 	restore(mask);
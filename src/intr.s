@@ -29,6 +29,7 @@
 ; this is a problem, but it is possible to re-map irqs.
 ; 
 ; maestro defines 16 irqs which will be mapped to interrupts 20h-2fh
+; interrupts 31h-3fh are raised by the local apics, see lapic.c
 
 [bits 32]
 
@@ -36,13 +37,13 @@
 	global set_vect
 	global ivect
 	global user_handlers
-	global disable
-	global restore
 	global isr_end
 
 
 	extern io_wait
 	extern isr
+	extern klock_acquire
+	extern klock_release
 
 	section .text
 
@@ -116,33 +117,6 @@ intr_init:
 
 	ret
 
-; locally enable / disable interrupts
-
-; cdecl - int disable()
-; returns the current value of IF register in eflags
-disable:
-	pushf						; push flags on stack
-	pop eax						; pop flags from stack into eax
-	cli							; disable interrupts
-	and eax, 202h				; clear all bits except IF flag (200h) and reserved flag (0x2)
-	ret
-
-; cdecl - void restore(int mask)
-; pass the return value of disable() to this function
-; to restore interrupts to the state they were in when disable() was called
-restore:
-	cli                         ; disable interrupts
-	push ebp                    ; set up stack frame
-	mov ebp, esp
-	mov eax, [ebp + 8]          ; eax <- saved flags argument
-	pushf                       ; push eflags on stack
-	pop ecx                     ; pop flags into ecx
-	or eax, ecx                 ; restore bits saved in disable() (200h and 0x2)
-	push eax                    ; push eax (containing restored flags) onto stack
-	popf                        ; pop restored flags
-	pop ebp
-	ret
-
 ; define exceptions (interrupts 0 - 31)
 ; exceptions 8, 10, 11, 12, 13, 14, 17, 21, 29, & 30 push error codes
 xint0:
@@ -334,6 +308,20 @@ sysc:
 	push 48
 	jmp isr_bootstrap
 
+; define local apic interrupts (interrupts 49 - 63)
+apic49:
+	push 0
+	push 49
+	jmp isr_bootstrap
+apic50:
+	push 0
+	push 50
+	jmp isr_bootstrap
+apic63:
+	push 0
+	push 63
+	jmp isr_bootstrap
+
 ; bootstrap the C isr handler
 ; before jumping here, an error code (or dummy 0) and interrupt number were just pushed onto the stack
 ; handler will save the program state with pusha, so the stack will look like this:
@@ -355,12 +343,28 @@ isr_bootstrap:
 	push fs
 	push gs
 
+	mov ax, 30h                        ; gs points at this cpu's struct cpu in the kernel, see smp.h
+	mov gs, ax
+
+	; the kernel lock is held exactly when interrupts are off (see smp.h).
+	; if they were on where this interrupt came from, this cpu doesn't have it yet
+	test dword [esp + 64], 200h        ; interrupted eflags
+	jz .locked
+	call klock_acquire
+.locked:
+
 	push esp
 	call isr
 
 isr_end:
 	add esp, 4                         ; restore stack state
 
+	; going back to where interrupts are on, so the lock goes
+	test dword [esp + 64], 200h        ; eflags iret will restore
+	jz .unlocked
+	call klock_release
+.unlocked:
+
 	pop gs                             ; restore segment registers
 	pop fs
 	pop es
@@ -428,6 +432,10 @@ ivect:
 	dd irq14
 	dd irq15
 	dd sysc
+	dd apic49
+	dd apic50
+	times 12 dd 0
+	dd apic63
 
 mystr:
 	db 'hello world', 0
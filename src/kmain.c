@@ -12,31 +12,31 @@
 #include <kmalloc.h>
 #include <kprintf.h>
 #include <proc.h>
+#include <smp.h>
 
 #include <elf.h>
 
 #include <stdio.h>
 #include <string.h>
 
-extern struct proc *curr;
-extern struct proc nullproc;
 extern void clear();
 
 void kmain()
 {
+	// everything after this can find the cpu it is running on
+	smp_early_init();
+
 	init();
 	clear();
 	kprintf("Welcome to maestro!\n");
-	curr = &nullproc;
 
     struct proc *init = create_usermode("/bin/init");
     ready(init);
 
-	// enable interrupts
-	asm("sti");
+	// enable interrupts, the other cpus are waiting for the kernel lock that goes with them
+	enable();
     sched();
 
 	// become the null process
-	while (1)
-		asm("hlt");
+	sched_idle();
 }
@@ -9,24 +9,68 @@
  */
 #include <kmalloc.h>
 
+#include <bitmap.h>
+#include <intr.h>
 #include <kprintf.h>
+#include <kprof.h>
 #include <vmm.h>
 
-// freelist sentinal - denotes the head of the doubly-linked freelist
-static struct header *sentinal;
+// free list sentinals - each denotes the head of a doubly-linked freelist of one size class
+static struct header freelists[N_LISTS];
 
-// pointers to the base of the heap, and current top
-void *base, *heap;
+// bit n is set when freelists[n] is not empty
+static u32 nonempty[BITMAP_WORDS(N_LISTS)];
+
+// pointers to the base and the top of the heap, everything in between is mapped
+static void *base, *heap;
 
 // rounds an number x up to the nearest multiple of 8
-#define round8(x) ((x + 7) & ~0x7);
+#define round8(x) (((x) + 7) & ~0x7)
+
+// smallest block that can hold the free list links, anything smaller can't be split off
+#define MIN_BLOCK_SIZE sizeof(struct header)
 
 static void insert_into_freelist(struct header *);
+static void remove_from_freelist(struct header *);
+static struct header *find_free_block(size_t);
+static void *allocate_block(struct header *, size_t);
+static void *heap_alloc(size_t);
+static void *heap_alloc_aligned(size_t, size_t);
+static void free_block(struct header *);
+static bool grow(size_t);
+static void shrink();
 
+/**
+ * @brief sets up the heap as a single free block between two fenceposts
+ * the fenceposts are never free, so coalescing stops at the edges of the heap
+ * @param p start of the memory to manage
+ * @param s size of the memory in bytes
+ */
 void kmalloc_init(void *p, size_t s)
 {
 	base = p;
-	heap = p;
+	heap = p + s;
+
+	for (int i = 0; i < N_LISTS; i++)
+	{
+		freelists[i].size_state = SENTINAL;
+		freelists[i].next       = &freelists[i];
+		freelists[i].prev       = &freelists[i];
+	}
+
+	struct header *left = base;
+	left->size_state = ALLOC_HEADER_SIZE | SENTINAL;
+	left->left_size  = 0;
+
+	struct header *block = get_right_header(left);
+	block->size_state = (s - 2 * ALLOC_HEADER_SIZE) | UNALLOCATED;
+	block->left_size  = ALLOC_HEADER_SIZE;
+
+	struct header *right = get_right_header(block);
+	right->size_state = ALLOC_HEADER_SIZE | SENTINAL;
+	right->left_size  = get_block_size(block);
+
+	insert_into_freelist(block);
 
 	(void) print_heap;
 	(void) print_freelist;
@@ -35,55 +79,350 @@ void kmalloc_init(void *p, size_t s)
 /**
  * @brief allocates memory on the kernel's heap
  * @param size the size in bytes of the request
- * @return pointer to the first usable data byte of the request
+ * @return pointer to the first usable data byte of the request, or NULL if the heap is exhausted
  */
 void *kmalloc(size_t size)
+{
+	void *p = heap_alloc(size);
+	kprof_alloc(p, size);
+	return p;
+}
+
+/**
+ * @brief allocates memory on the kernel's heap at an aligned address
+ *
+ * enough is allocated to find an aligned address inside the block with room for a free
+ * block in front of it. the space in front of and behind the aligned object is given back.
+ *
+ * @param size the size in bytes of the request
+ * @param alignment required alignment of the returned pointer, a power of 2
+ * @return aligned pointer to the first usable data byte of the request, or NULL if the heap is exhausted
+ */
+void *kmalloc_a(size_t size, size_t alignment)
+{
+	void *p = heap_alloc_aligned(size, alignment);
+	kprof_alloc(p, size);
+	return p;
+}
+
+/**
+ * @brief allocates a block big enough for size bytes
+ * kmalloc and kmalloc_a record the allocation for the profiler, so internal allocations go through here
+ */
+static void *heap_alloc(size_t size)
 {
 	if (size == 0)
 		return NULL;
 
-	void *ptr = heap;
-	heap += round8(size);
-	return ptr;
+	size_t request = round8(size + ALLOC_HEADER_SIZE);
+	if (request < MIN_BLOCK_SIZE)
+		request = MIN_BLOCK_SIZE;
+
+	int mask = disable();
+
+	struct header *h = find_free_block(request);
+	if (!h && grow(request))
+		h = find_free_block(request);
+
+	if (!h)
+	{
+		restore(mask);
+		kprintf("kmalloc: out of memory allocating %d bytes\n", size);
+		return NULL;
+	}
+
+	void *p = allocate_block(h, request);
+	restore(mask);
+	return p;
 }
 
-void *kmalloc_a(size_t size, size_t alignment)
+/**
+ * @brief allocates a block with an aligned data pointer, see kmalloc_a
+ */
+static void *heap_alloc_aligned(size_t size, size_t alignment)
 {
-	while ((uintptr_t) heap % alignment != 0)
-		heap += 1;
+	// every block is 8 byte aligned already
+	if (alignment <= 8)
+		return heap_alloc(size);
 
-	return kmalloc(size);
+	void *p = heap_alloc(size + alignment + MIN_BLOCK_SIZE);
+	if (!p)
+		return NULL;
+
+	int mask = disable();
+
+	struct header *h = (struct header *) (p - ALLOC_HEADER_SIZE);
+	uintptr_t data = ((uintptr_t) p + alignment - 1) & ~(alignment - 1);
+
+	if (data != (uintptr_t) p)
+	{
+		// the space in front has to be big enough to become a free block of its own
+		if (data - (uintptr_t) p < MIN_BLOCK_SIZE)
+			data += alignment;
+
+		size_t gap = data - (uintptr_t) p;
+		size_t total = get_block_size(h);
+
+		struct header *aligned = (struct header *) (data - ALLOC_HEADER_SIZE);
+		aligned->size_state = (total - gap) | ALLOCATED;
+		aligned->left_size  = gap;
+		get_right_header(aligned)->left_size = total - gap;
+
+		set_block_size(h, gap);
+		free_block(h);
+		h = aligned;
+	}
+
+	// give back whatever is left over past the end of the object
+	size_t need = round8(size + ALLOC_HEADER_SIZE);
+	size_t total = get_block_size(h);
+	if (total - need >= MIN_BLOCK_SIZE)
+	{
+		set_block_size(h, need);
+
+		struct header *tail = get_right_header(h);
+		tail->size_state = (total - need) | ALLOCATED;
+		tail->left_size  = need;
+		get_right_header(tail)->left_size = total - need;
+
+		free_block(tail);
+	}
+
+	restore(mask);
+	return (void *) data;
 }
 
 /**
  * @brief deallocates memory from the kernel's heap
  * @param p pointer to user's data that was returned by kmalloc
  */
-void kfree(void *p) { }
+void kfree(void *p)
+{
+	if (!p)
+		return;
+
+	struct header *h = (struct header *) (p - ALLOC_HEADER_SIZE);
+
+	if (p < base || p >= heap || get_block_state(h) != ALLOCATED)
+	{
+		kprintf("kfree: 0x%x was not allocated by kmalloc (or was already freed)\n", p);
+		return;
+	}
+
+	kprof_free(p);
+
+	int mask = disable();
+	free_block(h);
+	shrink();
+	restore(mask);
+}
 
 /**
- * @brief inserts a header in the front of a freelist
- * @param h header to insert
+ * @brief maps more memory at the top of the heap
+ *
+ * the right fencepost turns into the header of a block covering the new memory, and a new
+ * fencepost goes at the new top. freeing that block merges it with a free block in front of it.
+ *
+ * @param request size of the block that didn't fit, including its header
+ * @return true if the heap grew
  */
-static void insert_into_freelist(struct header *h)
+static bool grow(size_t request)
+{
+	// the old fencepost's bytes are reused, so this much is enough even if the top block is allocated
+	size_t bytes = (request + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (bytes < KHEAP_GROW_MIN)
+		bytes = KHEAP_GROW_MIN;
+
+	if ((uintptr_t) heap + bytes > KHEAP_BASE + KHEAP_MAX_SIZE)
+		return false;
+
+	if (vmm_map_kernel((uintptr_t) heap, bytes / PAGE_SIZE) < 0)
+		return false;
+
+	struct header *block = (struct header *) (heap - ALLOC_HEADER_SIZE);
+	block->size_state = bytes | ALLOCATED;
+
+	struct header *fencepost = get_right_header(block);
+	fencepost->size_state = ALLOC_HEADER_SIZE | SENTINAL;
+	fencepost->left_size  = bytes;
+
+	heap += bytes;
+	free_block(block);
+	return true;
+}
+
+/**
+ * @brief gives memory at the top of the heap back once a big enough free block collects there
+ * KHEAP_GROW_MIN bytes stay free at the top, so a heap hovering around a page boundary doesn't thrash
+ */
+static void shrink()
+{
+	struct header *fencepost = (struct header *) (heap - ALLOC_HEADER_SIZE);
+	struct header *top = get_left_header(fencepost);
+
+	if (get_block_state(top) != UNALLOCATED || get_block_size(top) < KHEAP_SHRINK_MIN)
+		return;
+
+	uintptr_t new_heap = ((uintptr_t) top + KHEAP_GROW_MIN + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (new_heap < KHEAP_BASE + KHEAP_INIT_SIZE)
+		new_heap = KHEAP_BASE + KHEAP_INIT_SIZE;
+
+	if (new_heap >= (uintptr_t) heap)
+		return;
+
+	remove_from_freelist(top);
+	set_block_size(top, new_heap - ALLOC_HEADER_SIZE - (uintptr_t) top);
+	insert_into_freelist(top);
+
+	fencepost = get_right_header(top);
+	fencepost->size_state = ALLOC_HEADER_SIZE | SENTINAL;
+	fencepost->left_size  = get_block_size(top);
+
+	vmm_unmap_kernel(new_heap, ((uintptr_t) heap - new_heap) / PAGE_SIZE);
+	heap = (void *) new_heap;
+}
+
+/**
+ * @brief gets the free list a block of a given size belongs in
+ */
+static inline uint list_index(size_t block_size)
 {
-	// freelist is empty
-	if (sentinal->next == sentinal)
+	uint i = block_size / 8 - 1;
+	return i < N_LISTS - 1 ? i : N_LISTS - 1;
+}
+
+/**
+ * @brief finds the first non empty free list at or after a given one
+ * @return index of the free list or -1 if they are all empty
+ */
+static int next_nonempty(uint from)
+{
+	for (uint w = from / 32; w < BITMAP_WORDS(N_LISTS); w++)
 	{
-		sentinal->prev = h;
-		sentinal->next = h;
-		h->prev        = sentinal;
-		h->next        = sentinal;
+		u32 bits = nonempty[w];
+		if (w == from / 32)
+			bits &= 0xffffffff << (from % 32);
+
+		if (bits)
+			return w * 32 + __builtin_ctz(bits);
 	}
 
-	// freelist is not empty
-	else
+	return -1;
+}
+
+/**
+ * @brief finds a free block of at least size bytes
+ *
+ * every list but the last holds blocks of a single size, so the head of the first
+ * non empty list big enough is a fit. only the last list has to be searched.
+ *
+ * @param size size of the block needed, including its header
+ * @return a free block or NULL if none is big enough
+ */
+static struct header *find_free_block(size_t size)
+{
+	int i = next_nonempty(list_index(size));
+	if (i < 0)
+		return NULL;
+
+	if (i < N_LISTS - 1)
+		return freelists[i].next;
+
+	struct header *sentinal = &freelists[N_LISTS - 1];
+	for (struct header *h = sentinal->next; h != sentinal; h = h->next)
 	{
-		h->next              = sentinal->next;
-		h->prev              = sentinal;
-		sentinal->next->prev = h;
-		sentinal->next       = h;
+		if (get_block_size(h) >= size)
+			return h;
 	}
+
+	return NULL;
+}
+
+/**
+ * @brief allocates size bytes out of a free block, splitting it if the rest is still usable
+ * @param h free block to allocate from
+ * @param size size of the allocation, including its header
+ * @return pointer to the first usable data byte
+ */
+static void *allocate_block(struct header *h, size_t size)
+{
+	size_t block_size = get_block_size(h);
+	remove_from_freelist(h);
+
+	if (block_size - size >= MIN_BLOCK_SIZE)
+	{
+		// the front stays free, the back is handed out
+		set_block_size(h, block_size - size);
+		insert_into_freelist(h);
+
+		struct header *alloc = get_right_header(h);
+		alloc->size_state = size | ALLOCATED;
+		alloc->left_size  = block_size - size;
+		get_right_header(alloc)->left_size = size;
+		return alloc->data;
+	}
+
+	set_block_state(h, ALLOCATED);
+	return h->data;
+}
+
+/**
+ * @brief frees a block, merging it with free neighbors on either side
+ * @param h allocated block to free
+ */
+static void free_block(struct header *h)
+{
+	struct header *left = get_left_header(h);
+	struct header *right = get_right_header(h);
+	size_t size = get_block_size(h);
+
+	if (get_block_state(right) == UNALLOCATED)
+	{
+		remove_from_freelist(right);
+		size += get_block_size(right);
+	}
+
+	if (get_block_state(left) == UNALLOCATED)
+	{
+		remove_from_freelist(left);
+		size += get_block_size(left);
+		h = left;
+	}
+
+	h->size_state = size | UNALLOCATED;
+	get_right_header(h)->left_size = size;
+	insert_into_freelist(h);
+}
+
+/**
+ * @brief inserts a header in the front of the freelist for its size
+ * @param h header to insert
+ */
+static void insert_into_freelist(struct header *h)
+{
+	uint i = list_index(get_block_size(h));
+	struct header *sentinal = &freelists[i];
+
+	h->next              = sentinal->next;
+	h->prev              = sentinal;
+	sentinal->next->prev = h;
+	sentinal->next       = h;
+
+	BITMAP_SET(nonempty, i);
+}
+
+/**
+ * @brief unlinks a header from its freelist
+ * @param h header to remove, its size must not have changed since it was inserted
+ */
+static void remove_from_freelist(struct header *h)
+{
+	h->prev->next = h->next;
+	h->next->prev = h->prev;
+
+	uint i = list_index(get_block_size(h));
+	if (freelists[i].next == &freelists[i])
+		BITMAP_CLEAR(nonempty, i);
 }
 
 static const char *state_strings[] = {
@@ -111,15 +450,18 @@ void print_heap()
 void print_freelist()
 {
 	kprintf("\tFREELIST: \n");
-	struct header *freelist = sentinal;
 
-	do
+	for (int i = 0; i < N_LISTS; i++)
 	{
-		kprintf("addr: 0x%x\n", freelist);
-		kprintf("size: %d (%xh)\n", get_block_size(freelist), get_block_size(freelist));
-		kprintf("prev: 0x%x\n", freelist->prev);
-		kprintf("next: 0x%x\n\n", freelist->next);
+		struct header *sentinal = &freelists[i];
 
-		freelist = freelist->next;
-	} while (freelist != sentinal);
+		for (struct header *h = sentinal->next; h != sentinal; h = h->next)
+		{
+			kprintf("list: %d\n", i);
+			kprintf("addr: 0x%x\n", h);
+			kprintf("size: %d (%xh)\n", get_block_size(h), get_block_size(h));
+			kprintf("prev: 0x%x\n", h->prev);
+			kprintf("next: 0x%x\n\n", h->next);
+		}
+	}
 }
@@ -0,0 +1,254 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: kprof.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: kernel allocation profiler
+ *
+ * Live allocations sit in an open addressed hash table keyed by their address, and point
+ * at the call site that made them. Call sites are found by walking the saved frame pointers
+ * out of the allocator, so the kernel has to keep them (config.mk adds -fno-omit-frame-pointer).
+ */
+#ifdef KMALLOC_PROFILE
+
+#include <kprof.h>
+
+#include <clk.h>
+#include <intr.h>
+#include <kprintf.h>
+#include <vmm.h>
+
+// slot of the live table whose allocation was freed, searches have to keep going past it
+#define TOMBSTONE ((void *) 1)
+
+struct site
+{
+	uintptr_t callers[KPROF_DEPTH];    // return addresses, innermost first, 0 past the end of the stack
+	u32 allocs;                        // allocations made here
+	u32 frees;                         // allocations made here that were freed
+	u32 live_bytes;                    // bytes allocated here that are still live
+	u32 total_bytes;                   // bytes ever allocated here
+	u32 first;                         // uptime of the first allocation, for the rate
+};
+
+struct record
+{
+	void *ptr;      // NULL if the slot was never used, TOMBSTONE if it was freed
+	u32 size;
+	u32 time;       // uptime when it was allocated
+	u16 site;       // index into sites
+};
+
+static struct site sites[KPROF_SITES];
+static uint nsites;
+
+static struct record live[KPROF_ALLOCS];
+
+// allocations that weren't recorded because a table was full
+static u32 untracked;
+
+static inline uint hash(uintptr_t key, uint size)
+{
+	return (key * 2654435761u) % size;
+}
+
+/**
+ * @brief finds the call site for a backtrace, or the empty slot it would go in if it's new
+ * @return index of the site or -1 if the table is full
+ */
+static int find_site(const uintptr_t *callers)
+{
+	uintptr_t key = 0;
+	for (int d = 0; d < KPROF_DEPTH; d++)
+		key ^= callers[d];
+
+	uint i = hash(key, KPROF_SITES);
+
+	for (uint n = 0; n < KPROF_SITES; n++, i = (i + 1) % KPROF_SITES)
+	{
+		struct site *s = &sites[i];
+
+		if (s->allocs == 0)
+		{
+			for (int d = 0; d < KPROF_DEPTH; d++)
+				s->callers[d] = callers[d];
+
+			return i;
+		}
+
+		bool match = true;
+		for (int d = 0; d < KPROF_DEPTH; d++)
+			match &= s->callers[d] == callers[d];
+
+		if (match)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief records an allocation, attributing it to whoever called the allocator
+ * has to be called from the allocator's entry point itself, so the first frame skipped is the allocator's
+ * @param p object handed out
+ * @param size size of the object in bytes
+ */
+void kprof_alloc(void *p, size_t size)
+{
+	if (!p)
+		return;
+
+	uintptr_t callers[KPROF_DEPTH] = { 0 };
+
+	// our frame links to the allocator's, whose return address is its caller
+	u32 *fp = __builtin_frame_address(0);
+	fp = (u32 *) fp[0];
+
+	// the chain ends at the bottom of a kernel stack, or in user space for frames below an interrupt
+	for (int d = 0; d < KPROF_DEPTH && (uintptr_t) fp >= KERNEL_BASE; d++)
+	{
+		callers[d] = fp[1];
+		fp = (u32 *) fp[0];
+	}
+
+	int mask = disable();
+
+	int site = find_site(callers);
+	if (site < 0)
+	{
+		untracked++;
+		restore(mask);
+		return;
+	}
+
+	uint i = hash((uintptr_t) p >> 3, KPROF_ALLOCS);
+	for (uint n = 0; n < KPROF_ALLOCS; n++, i = (i + 1) % KPROF_ALLOCS)
+	{
+		if (live[i].ptr == NULL || live[i].ptr == TOMBSTONE)
+		{
+			live[i].ptr  = p;
+			live[i].size = size;
+			live[i].time = uptime();
+			live[i].site = site;
+
+			struct site *s = &sites[site];
+			if (s->allocs++ == 0)
+			{
+				s->first = live[i].time;
+				nsites++;
+			}
+
+			s->live_bytes  += size;
+			s->total_bytes += size;
+
+			restore(mask);
+			return;
+		}
+	}
+
+	untracked++;
+	restore(mask);
+}
+
+/**
+ * @brief records an allocation being freed
+ * objects that weren't recorded (handed out while a table was full) are ignored
+ * @param p object being freed
+ */
+void kprof_free(void *p)
+{
+	if (!p)
+		return;
+
+	int mask = disable();
+
+	uint i = hash((uintptr_t) p >> 3, KPROF_ALLOCS);
+	for (uint n = 0; n < KPROF_ALLOCS && live[i].ptr; n++, i = (i + 1) % KPROF_ALLOCS)
+	{
+		if (live[i].ptr == p)
+		{
+			struct site *s = &sites[live[i].site];
+			s->frees++;
+			s->live_bytes -= live[i].size;
+
+			live[i].ptr = TOMBSTONE;
+			break;
+		}
+	}
+
+	restore(mask);
+}
+
+/**
+ * @brief prints every call site, the ones holding the most memory first
+ *
+ * each line has a site's backtrace, its live allocations and bytes, the allocations and frees
+ * made so far, the allocation rate, and the age of its oldest live allocation. a site whose
+ * live count only goes up, with an old oldest allocation, is leaking.
+ *
+ * @return 0
+ */
+int kprof_dump()
+{
+	static u16 order[KPROF_SITES];
+	static u32 oldest[KPROF_SITES];
+
+	int mask = disable();
+
+	u32 now = uptime();
+	u32 live_bytes = 0;
+	u32 live_count = 0;
+
+	for (int i = 0; i < KPROF_SITES; i++)
+		oldest[i] = now;
+
+	for (int i = 0; i < KPROF_ALLOCS; i++)
+	{
+		if (live[i].ptr == NULL || live[i].ptr == TOMBSTONE)
+			continue;
+
+		if (live[i].time < oldest[live[i].site])
+			oldest[live[i].site] = live[i].time;
+
+		live_bytes += live[i].size;
+		live_count++;
+	}
+
+	// insertion sort the used sites by live bytes, there are few enough of them
+	uint n = 0;
+	for (int i = 0; i < KPROF_SITES; i++)
+	{
+		if (sites[i].allocs == 0)
+			continue;
+
+		uint j = n++;
+		for (; j > 0 && sites[order[j - 1]].live_bytes < sites[i].live_bytes; j--)
+			order[j] = order[j - 1];
+
+		order[j] = i;
+	}
+
+	kprintf("KMALLOC PROFILE: %d bytes live in %d allocations from %d sites, %d untracked\n",
+		live_bytes, live_count, nsites, untracked);
+
+	for (uint k = 0; k < n; k++)
+	{
+		struct site *s = &sites[order[k]];
+		u32 nlive = s->allocs - s->frees;
+		u32 age = now - s->first + 1;
+
+		// allocs * 1000 overflows past ~4M allocations, so a site older than a second is measured in whole seconds
+		u32 rate = age < 1000 ? s->allocs / age * 1000 + s->allocs % age * 1000 / age : s->allocs / (age / 1000);
+
+		kprintf("site 0x%x 0x%x 0x%x live %d bytes %d allocs %d frees %d total %d rate %d/s oldest %dms\n",
+			s->callers[0], s->callers[1], s->callers[2], nlive, s->live_bytes, s->allocs, s->frees,
+			s->total_bytes, rate, nlive ? now - oldest[order[k]] : 0);
+	}
+
+	restore(mask);
+	return 0;
+}
+
+#endif    // KMALLOC_PROFILE
@@ -0,0 +1,166 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: lapic.c
+ * DATE: October 18th, 2026
+ * DESCRIPTION: each cpu's local apic: its timer and interprocessor interrupts
+ *
+ * Every cpu sees its own local apic at the same physical address, so a single mapping
+ * serves them all. The PIC stays wired to the boot cpu, the local apics are only used for
+ * interrupts between cpus and for a timer on each cpu, which the scheduler programs for
+ * the end of the running process's quantum. The timer runs at the bus clock, which nothing
+ * reports, so it is measured against the PIT once at boot.
+ */
+#include <lapic.h>
+
+#include <clk.h>
+#include <intr.h>
+#include <kprintf.h>
+#include <vmalloc.h>
+
+// register offsets
+#define LAPIC_ID          0x020
+#define LAPIC_TPR         0x080    // task priority
+#define LAPIC_EOI         0x0b0
+#define LAPIC_SVR         0x0f0    // spurious interrupt vector
+#define LAPIC_ICR_LOW     0x300    // interrupt command
+#define LAPIC_ICR_HIGH    0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_TIMER_INIT  0x380    // initial count, writing it starts the timer
+#define LAPIC_TIMER_CUR   0x390    // current count
+#define LAPIC_TIMER_DIV   0x3e0
+
+#define SVR_ENABLE        0x100
+#define LVT_MASKED        0x10000
+#define TIMER_DIV_16      0x3
+
+// ms the timer is measured against the PIT for
+#define CALIBRATE_MS 20
+
+static volatile u32 *regs;
+
+// timer counts in a ms, 0 until the timer has been measured
+static u32 ticks_per_ms;
+
+static inline u32 lapic_read(u32 reg)
+{
+	return regs[reg / 4];
+}
+
+static inline void lapic_write(u32 reg, u32 val)
+{
+	regs[reg / 4] = val;
+}
+
+/**
+ * @brief maps the local apics
+ * @param phys physical address of the local apics, from the MADT
+ * @return 0 on success, -1 if they couldn't be mapped
+ */
+int lapic_setup(uintptr_t phys)
+{
+	regs = ioremap(phys, 0x400);
+	if (!regs)
+	{
+		kprintf("lapic_setup: couldn't map the local apic at 0x%x\n", phys);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief enables the local apic of the cpu this is running on, with its timer stopped
+ */
+void lapic_init()
+{
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS);
+
+	// one-shot, an initial count of 0 keeps it stopped
+	lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+	lapic_write(LAPIC_TIMER_INIT, 0);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER);
+}
+
+/**
+ * @brief measures how fast the timer counts, every cpu's timer is assumed to count as fast as this one's
+ * once it is done the scheduler uses the timers instead of the PIT for quanta
+ */
+void lapic_calibrate()
+{
+	lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER);
+	lapic_write(LAPIC_TIMER_INIT, 0xffffffff);
+
+	clk_delay(CALIBRATE_MS);
+
+	u32 ticks = 0xffffffff - lapic_read(LAPIC_TIMER_CUR);
+	lapic_write(LAPIC_TIMER_INIT, 0);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER);
+
+	ticks_per_ms = ticks / CALIBRATE_MS;
+	kprintf("lapic: timer runs at %d counts per ms\n", ticks_per_ms);
+}
+
+/**
+ * @brief apic id of the cpu this is running on
+ */
+u8 lapic_id()
+{
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi()
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * @brief sends an interprocessor interrupt, waiting until it has been delivered
+ * @param apic_id local apic of the cpu to send it to
+ * @param cmd delivery mode, flags and vector
+ */
+void lapic_ipi(u8 apic_id, u32 cmd)
+{
+	lapic_write(LAPIC_ICR_HIGH, (u32) apic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, cmd);
+
+	while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING)
+		asm volatile("pause");
+}
+
+/**
+ * @brief whether the timers have been measured, until then the PIT keeps track of quanta
+ */
+bool lapic_timer_ready()
+{
+	return ticks_per_ms != 0;
+}
+
+/**
+ * @brief programs this cpu's timer to interrupt once, cancelling whatever it was set for
+ * @param ms ms until the interrupt, (u32) -1 only stops the timer
+ * @return false if the timer hasn't been measured yet and the PIT has to do
+ */
+bool lapic_timer_arm(u32 ms)
+{
+	if (!ticks_per_ms)
+		return false;
+
+	if (ms == (u32) -1)
+	{
+		lapic_write(LAPIC_TIMER_INIT, 0);
+		return true;
+	}
+
+	if (ms == 0)
+		ms = 1;
+
+	if (ms > 0xffffffff / ticks_per_ms)
+		ms = 0xffffffff / ticks_per_ms;
+
+	lapic_write(LAPIC_TIMER_INIT, ms * ticks_per_ms);
+	return true;
+}
@@ -0,0 +1,227 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: lz.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: fast lz77 compression
+ */
+#include <lz.h>
+
+#include <string.h>
+
+// bytes at the end of the input that are always left as literals, so checking
+// a match never reads past the end
+#define LZ_TAIL 8
+
+static inline u32 read32(const u8 *p)
+{
+	return *(const u32 *) p;
+}
+
+static inline u32 hash(u32 seq)
+{
+	return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief writes the extra bytes of a length that didn't fit in its nibble
+ * @return the new end of the output or NULL if it ran out of room
+ */
+static u8 *put_len(u8 *op, u8 *oend, size_t len)
+{
+	for (; len >= 255; len -= 255)
+	{
+		if (op >= oend)
+			return NULL;
+
+		*op++ = 255;
+	}
+
+	if (op >= oend)
+		return NULL;
+
+	*op++ = len;
+	return op;
+}
+
+/**
+ * @brief writes a sequence
+ * @param lit literals to copy
+ * @param nlit number of literals
+ * @param off match offset, or 0 for the last sequence which has no match
+ * @param mlen match length minus LZ_MIN_MATCH
+ * @return the new end of the output or NULL if it ran out of room
+ */
+static u8 *put_seq(u8 *op, u8 *oend, const u8 *lit, size_t nlit, size_t off, size_t mlen)
+{
+	if (op >= oend)
+		return NULL;
+
+	u8 *token = op++;
+	*token = (nlit < 15 ? nlit : 15) << 4;
+
+	if (nlit >= 15 && !(op = put_len(op, oend, nlit - 15)))
+		return NULL;
+
+	if (nlit > (size_t) (oend - op))
+		return NULL;
+
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (off == 0)
+		return op;
+
+	if (oend - op < 2)
+		return NULL;
+
+	*op++ = off;
+	*op++ = off >> 8;
+
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		return put_len(op, oend, mlen - 15);
+
+	return op;
+}
+
+/**
+ * @brief compresses a buffer
+ *
+ * matches are found through a hash table of the positions of recently seen 4 byte
+ * sequences. entries are checked against the data before being used, so the table
+ * doesn't need to be cleared between calls and leftovers only cost a missed match.
+ *
+ * @param src data to compress, at most 64K
+ * @param n size of src in bytes
+ * @param dst buffer to compress into
+ * @param cap size of dst in bytes
+ * @param work LZ_WORK_SIZE bytes for the compressor's table
+ * @return size of the compressed data or 0 if it didn't fit in cap
+ */
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap, void *work)
+{
+	u16 *table = work;
+	const u8 *in = src;
+	const u8 *end = in + n;
+	const u8 *limit = n > LZ_TAIL ? end - LZ_TAIL : in;
+	const u8 *ip = in;
+	const u8 *anchor = in;
+	u8 *op = dst;
+	u8 *oend = op + cap;
+
+	while (ip < limit)
+	{
+		u32 seq = read32(ip);
+		u32 h = hash(seq);
+		const u8 *ref = in + table[h];
+		table[h] = ip - in;
+
+		if (ref >= ip || ip - ref > 0xffff || read32(ref) != seq)
+		{
+			ip++;
+			continue;
+		}
+
+		const u8 *mend = ip + LZ_MIN_MATCH;
+		ref += LZ_MIN_MATCH;
+		while (mend < limit && *mend == *ref)
+		{
+			mend++;
+			ref++;
+		}
+
+		op = put_seq(op, oend, anchor, ip - anchor, mend - ref, mend - ip - LZ_MIN_MATCH);
+		if (!op)
+			return 0;
+
+		ip = anchor = mend;
+	}
+
+	op = put_seq(op, oend, anchor, end - anchor, 0, 0);
+	if (!op)
+		return 0;
+
+	return op - (u8 *) dst;
+}
+
+/**
+ * @brief decompresses what lz_compress produced
+ * @param src compressed data
+ * @param n size of src in bytes
+ * @param dst buffer to decompress into
+ * @param cap size of dst in bytes
+ * @return size of the decompressed data or 0 if src is corrupt or doesn't fit in cap
+ */
+size_t lz_decompress(const void *src, size_t n, void *dst, size_t cap)
+{
+	const u8 *ip = src;
+	const u8 *iend = ip + n;
+	u8 *op = dst;
+	u8 *oend = op + cap;
+
+	while (ip < iend)
+	{
+		u8 token = *ip++;
+		u8 b;
+
+		size_t nlit = token >> 4;
+		if (nlit == 15)
+		{
+			do
+			{
+				if (ip >= iend)
+					return 0;
+
+				b = *ip++;
+				nlit += b;
+			} while (b == 255);
+		}
+
+		if (nlit > (size_t) (iend - ip) || nlit > (size_t) (oend - op))
+			return 0;
+
+		memcpy(op, ip, nlit);
+		op += nlit;
+		ip += nlit;
+
+		// the last sequence ends with its literals
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return 0;
+
+		size_t off = ip[0] | ip[1] << 8;
+		ip += 2;
+
+		if (off == 0 || off > (size_t) (op - (u8 *) dst))
+			return 0;
+
+		size_t mlen = token & 15;
+		if (mlen == 15)
+		{
+			do
+			{
+				if (ip >= iend)
+					return 0;
+
+				b = *ip++;
+				mlen += b;
+			} while (b == 255);
+		}
+
+		mlen += LZ_MIN_MATCH;
+		if (mlen > (size_t) (oend - op))
+			return 0;
+
+		// byte at a time, a match can overlap the bytes it is producing
+		const u8 *ref = op - off;
+		while (mlen--)
+			*op++ = *ref++;
+	}
+
+	return op - (u8 *) dst;
+}
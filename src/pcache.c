@@ -0,0 +1,187 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: pcache.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: page cache for ext2 file data
+ */
+#include <pcache.h>
+
+#include <ext2.h>
+#include <intr.h>
+#include <kmalloc.h>
+#include <kprintf.h>
+#include <pmm.h>
+#include <vmm.h>
+
+#include <string.h>
+
+#define PCACHE_BUCKETS 256
+
+/**
+ * a page of a file held in the cache
+ * the cache owns one reference to frame, every mapping of it holds another
+ */
+struct cached_page
+{
+	u32 inode;
+	u32 index;                  // page of the file, i.e. offset / PAGE_SIZE
+	uintptr_t frame;
+	struct cached_page *next;
+};
+
+static struct cached_page *buckets[PCACHE_BUCKETS];
+
+// bucket pcache_shrink starts at next, so the same pages aren't always the first to go
+static uint shrink_hand;
+
+static inline uint hash(u32 inode, u32 index)
+{
+	return (inode * 31 + index) % PCACHE_BUCKETS;
+}
+
+/**
+ * @brief looks up a page of a file, reading it in if it isn't cached yet
+ *
+ * bytes of the page past the end of the file read as zero.
+ * callers that map the frame must take their own reference with pmm_ref.
+ *
+ * @param inode inode of the file
+ * @param index page of the file
+ * @return physical address of the frame holding the page, or 0 if out of memory
+ */
+uintptr_t pcache_get(u32 inode, u32 index)
+{
+	int mask = disable();
+	uint b = hash(inode, index);
+
+	for (struct cached_page *cp = buckets[b]; cp; cp = cp->next)
+	{
+		if (cp->inode == inode && cp->index == index)
+		{
+			restore(mask);
+			return cp->frame;
+		}
+	}
+
+	// only the last page of a file has a tail that has to be zeroed
+	size_t off = index * PAGE_SIZE;
+	size_t size = ext2_filesize(inode);
+	uintptr_t frame = off + PAGE_SIZE <= size ? pmm_alloc() : pmm_alloc_zeroed();
+	if (!frame)
+	{
+		restore(mask);
+		kprintf("pcache_get: out of memory\n");
+		return 0;
+	}
+
+	void *page = phys_to_virt(frame);
+	if (off < size)
+		ext2_read_data(page, inode, off, size - off < PAGE_SIZE ? size - off : PAGE_SIZE);
+
+	struct cached_page *cp = kmalloc(sizeof(struct cached_page));
+	cp->inode = inode;
+	cp->index = index;
+	cp->frame = frame;
+	cp->next  = buckets[b];
+	buckets[b] = cp;
+
+	struct page *pg = pmm_page(frame);
+	pg->flags |= PG_PCACHE;
+	pg->owner  = cp;
+
+	restore(mask);
+	return frame;
+}
+
+/**
+ * @brief keeps cached pages of a file in step with a write that went straight to disk
+ * @param inode inode of the file that was written
+ * @param off byte offset the write started at
+ * @param buff data that was written
+ * @param count number of bytes written
+ */
+void pcache_update(u32 inode, size_t off, const void *buff, size_t count)
+{
+	int mask = disable();
+
+	while (count)
+	{
+		u32 index = off / PAGE_SIZE;
+		size_t page_off = off % PAGE_SIZE;
+		size_t n = PAGE_SIZE - page_off < count ? PAGE_SIZE - page_off : count;
+
+		for (struct cached_page *cp = buckets[hash(inode, index)]; cp; cp = cp->next)
+		{
+			if (cp->inode == inode && cp->index == index)
+			{
+				memcpy(phys_to_virt(cp->frame) + page_off, buff, n);
+				break;
+			}
+		}
+
+		off += n;
+		buff += n;
+		count -= n;
+	}
+
+	restore(mask);
+}
+
+/**
+ * @brief drops cached pages nothing has mapped, giving their frames back
+ *
+ * a page goes only once the cache holds the last reference to its frame. a PG_DIRTY
+ * page is written back to its file first, but only if writeback is set: writing
+ * allocates, so reclaim in the middle of an allocation only asks for clean pages.
+ *
+ * @param nr number of pages to drop
+ * @param writeback whether dirty pages may be written back and dropped
+ * @return number of pages dropped
+ */
+size_t pcache_shrink(size_t nr, bool writeback)
+{
+	// writing back allocates, which may come back here looking for memory
+	static bool shrinking;
+
+	if (shrinking)
+		return 0;
+
+	int mask = disable();
+	shrinking = true;
+
+	size_t dropped = 0;
+	for (uint i = 0; i < PCACHE_BUCKETS && dropped < nr; i++)
+	{
+		struct cached_page **link = &buckets[shrink_hand];
+
+		while (*link && dropped < nr)
+		{
+			struct cached_page *cp = *link;
+			struct page *pg = pmm_page(cp->frame);
+
+			if (pmm_refcount(cp->frame) != 1 || (pg->flags & PG_LOCKED) || ((pg->flags & PG_DIRTY) && !writeback))
+			{
+				link = &cp->next;
+				continue;
+			}
+
+			if (pg->flags & PG_DIRTY)
+				ext2_write_data(phys_to_virt(cp->frame), cp->inode, cp->index * PAGE_SIZE, PAGE_SIZE);
+
+			*link = cp->next;
+			pmm_unref(cp->frame);
+			kfree(cp);
+			dropped++;
+		}
+
+		if (dropped < nr)
+			shrink_hand = (shrink_hand + 1) % PCACHE_BUCKETS;
+	}
+
+	shrinking = false;
+	restore(mask);
+	return dropped;
+}
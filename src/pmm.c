@@ -9,8 +9,13 @@
  */
 #include <pmm.h>
 
-#include <bitmap.h>
+#include <cpu.h>
+#include <intr.h>
 #include <kprintf.h>
+#include <pcache.h>
+#include <smp.h>
+#include <swap.h>
+#include <vmm.h>
 
 #include <string.h>
 
@@ -30,22 +35,69 @@ static u32 mem_size = 0;
 static u32 used_blocks;
 
 // max number of blocks the system can allocate
-// this should always be equivalent to mem_size / BLOCK_SIZE
+// this is the block index just past the highest available byte of memory
 static u32 max_blocks;
 
-// bitmap of block allocation status
-// a set bit denotes the block is used
-// the bitmap is placed immediately after the kernel image in memory so we don't have to call kmalloc() to dynamically allocate it
-// the kernel heap will be placed right after the bitmap
+// marks the end of a free list
+#define NO_BLOCK 0xffffffff
+
+// per-block bookkeeping, indexed by block number, see struct page
+// the array is placed immediately after the kernel image in memory so we don't have to call kmalloc() to dynamically allocate it
 // it's like a free call to kmalloc :)
-static u32 *mmap = &end;
+static struct page *pages = (struct page *) &end;
+
+// heads of the free lists, one per order
+static u32 free_lists[PMM_MAX_ORDER + 1];
+
+// bit n is set when free_lists[n] is not empty
+static u32 free_orders;
 
 // block the kernel starts/ends on
 // i.e. start_block * BLOCK_SIZE = start_phys
 // and    end_block * BLOCK_SIZE = end_phys
 static u32 start_block, end_block;
 
-extern void *heap;
+// blocks zeroed ahead of time by the idle loop, already allocated with one reference each.
+// when the buddy allocator runs dry they're handed out like any other block
+static uintptr_t zero_pool[ZERO_POOL_SIZE];
+static uint zero_count;
+
+static uintptr_t buddy_alloc(uint);
+static void buddy_insert(u32, uint);
+static void free_range(u32, u32);
+static void free_unreserved(u32, u32, const u32 (*)[2], int);
+
+static inline void list_push(u32 idx, uint order)
+{
+	pages[idx].order = order;
+	pages[idx].free  = 1;
+	pages[idx].prev  = NO_BLOCK;
+	pages[idx].next  = free_lists[order];
+
+	if (free_lists[order] != NO_BLOCK)
+		pages[free_lists[order]].prev = idx;
+
+	free_lists[order] = idx;
+	free_orders |= 1 << order;
+}
+
+static inline void list_remove(u32 idx, uint order)
+{
+	struct page *b = &pages[idx];
+
+	if (b->prev != NO_BLOCK)
+		pages[b->prev].next = b->next;
+	else
+		free_lists[order] = b->next;
+
+	if (free_lists[order] == NO_BLOCK)
+		free_orders &= ~(1 << order);
+
+	if (b->next != NO_BLOCK)
+		pages[b->next].prev = b->prev;
+
+	b->free = 0;
+}
 
 void pmm_init()
 {
@@ -77,6 +129,9 @@ void pmm_init()
 	struct mmap_entry *ent = (struct mmap_entry *) MMAP_BASE;
 	char typestr[32];
 
+	// end of the highest available region
+	u32 mem_top = 0;
+
 	while ((u32) ent->base != MMAP_MAGIC)
 	{
 		// cast to 32 bit to avoid tricky implicit conversions...
@@ -107,6 +162,9 @@ void pmm_init()
 
 		mem_size += ent->len;
 
+		if (ent->type == MMAP_MEMORY_AVAILABLE && base + len > mem_top)
+			mem_top = base + len;
+
 		kprintf("0x%8x-0x%8x: | 0x%8x | %s (%d)\n", base, base + len - 1, len, typestr, ent->type);
 		ent++;
 	}
@@ -122,13 +180,33 @@ void pmm_init()
 	start_block = (u32) &start_phys / BLOCK_SIZE;
 	end_block   = (u32) &end_phys   / BLOCK_SIZE;
 
-	// the number of bytes mmap bitmap takes up is conveniently exactly equal to max_blocks
-	max_blocks = mem_size / BLOCK_SIZE;
+	// the kernel reaches every frame through the direct map, so memory it doesn't cover goes unused
+	if (mem_top > PHYS_MAP_SIZE)
+	{
+		kprintf("Ignoring memory above 0x%x\n", PHYS_MAP_SIZE);
+		mem_top = PHYS_MAP_SIZE;
+	}
 
-	// mark every block as reserved
-	memset(mmap, 0xff, max_blocks);
+	max_blocks = mem_top / BLOCK_SIZE;
 
-	// loop back through the memory map and mark available blocks as available
+	for (int i = 0; i <= PMM_MAX_ORDER; i++)
+		free_lists[i] = NO_BLOCK;
+
+	// every block starts out reserved
+	memset(pages, 0, max_blocks * sizeof(struct page));
+	used_blocks = max_blocks;
+
+	// how many blocks the page array itself takes up
+	u32 meta_blocks = BLOCK_ALIGN(max_blocks * sizeof(struct page)) / BLOCK_SIZE;
+
+	// ranges that must never be handed out: the kernel image and the block array,
+	// which are one contiguous physical range, and the page the other cpus start up in
+	const u32 reserved[][2] = {
+		{ start_block, end_block + meta_blocks },
+		{ AP_TRAMPOLINE / BLOCK_SIZE, AP_TRAMPOLINE / BLOCK_SIZE + 1 },
+	};
+
+	// loop back through the memory map and hand available blocks to the buddy allocator
 	ent = (struct mmap_entry *) MMAP_BASE;
 	while ((u32) ent->base != MMAP_MAGIC)
 	{
@@ -138,38 +216,29 @@ void pmm_init()
 
 		if (ent->type == MMAP_MEMORY_AVAILABLE)
 		{
-			u32 block = base / BLOCK_SIZE;
-			for (size_t i = 0; i < len / BLOCK_SIZE; i++)
-				BITMAP_CLEAR(mmap, block + i);
+			// only whole blocks inside the region are usable
+			u32 first = BLOCK_ALIGN(base) / BLOCK_SIZE;
+			u32 last  = (base + len) / BLOCK_SIZE;
+
+			if (last > max_blocks)
+				last = max_blocks;
+			if (first >= last)
+			{
+				ent++;
+				continue;
+			}
+
+			// block 0 is never handed out so that 0 can signal allocation failure
+			if (first == 0)
+				first = 1;
+
+			free_unreserved(first, last, reserved, sizeof(reserved) / sizeof(reserved[0]));
 		}
 
 		ent++;
 	}
 
-	// after this, the kernel's blocks will be marked as clear, so we have to re-reserve them
-	// calculate kernel size in blocks
-	u32 kernel_blocks = (u32) &size / BLOCK_SIZE;
-	for (size_t i = 0; i < kernel_blocks; i++)
-		BITMAP_SET(mmap, start_block + i);
-	
-	// same with mmap
-	// how many blocks the mmap itself takes up
-	u32 mmap_blocks = BLOCK_ALIGN(max_blocks) / BLOCK_SIZE;
-	for (size_t i = 0; i < mmap_blocks; i++)
-		BITMAP_SET(mmap, end_block + i);
-
-	// kernel heap can begin immediately after mmap (on a block-aligned boundary)
-	heap = (void *) ((u8 *) mmap + mmap_blocks * BLOCK_SIZE);
-
-	// finally, print out calculated memory stats
-	int free_blocks = 0;
-	for (size_t block = 0; block < max_blocks; block++)
-	{
-		if (!BITMAP_TEST(mmap, block))
-			free_blocks++;
-        else
-            used_blocks++;
-	}
+	u32 free_blocks = max_blocks - used_blocks;
 
 	kprintf("Installed memory: %d bytes (%d blocks)\n", max_blocks * BLOCK_SIZE, max_blocks);
 	kprintf("Free memory: %d bytes (%d blocks)\n", free_blocks * BLOCK_SIZE, free_blocks);
@@ -177,18 +246,334 @@ void pmm_init()
 
 /**
  * @brief allocate a block of physical memory
- * @return physical address of allocated block
+ * @return physical address of allocated block, or 0 if out of memory
  */
 uintptr_t pmm_alloc()
 {
-	int idx = BITMAP_FIRST_CLEAR(mmap, max_blocks);
+	return pmm_alloc_order(0);
+}
+
+/**
+ * @brief allocate a physically contiguous run of blocks
+ * @param order log2 of the number of blocks to allocate
+ * @return physical address of the first block, aligned to the size of the run, or 0 if out of memory
+ */
+uintptr_t pmm_alloc_order(uint order)
+{
+	if (order > PMM_MAX_ORDER)
+		return 0;
+
+	uintptr_t addr = buddy_alloc(order);
+	if (addr)
+		return addr;
+
+	int mask = disable();
+	if (order == 0 && zero_count > 0)
+	{
+		addr = zero_pool[--zero_count];
+		pages[addr / BLOCK_SIZE].flags &= ~PG_ZEROED;
+		restore(mask);
+		return addr;
+	}
+
+	restore(mask);
+
+	// memory is really gone. clean file pages nothing maps are dropped from the page cache
+	// first, getting them back is only a read. then user pages are pushed out to swap, and
+	// once that is full too, dirty file pages are written back and dropped. each frees a block
+	while (order == 0 && (pcache_shrink(1, false) || swap_out() || pcache_shrink(1, true)))
+	{
+		addr = buddy_alloc(0);
+		if (addr)
+			return addr;
+	}
+
+	kprintf("pmm_alloc: out of physical memory!\n");
+	return 0;
+}
+
+/**
+ * @brief allocate a block of physical memory that is filled with zeroes
+ *
+ * blocks come from the pool the idle loop fills, so callers that need a clean page
+ * (page tables, anonymous memory) usually don't pay for zeroing it. once the pool runs
+ * dry the block is zeroed on the spot.
+ *
+ * @return physical address of allocated block, or 0 if out of memory
+ */
+uintptr_t pmm_alloc_zeroed()
+{
+	int mask = disable();
+	if (zero_count > 0)
+	{
+		uintptr_t addr = zero_pool[--zero_count];
+		pages[addr / BLOCK_SIZE].flags &= ~PG_ZEROED;
+		restore(mask);
+		return addr;
+	}
+
+	restore(mask);
+
+	uintptr_t addr = pmm_alloc();
+	if (addr)
+		vmm_zero_frames(addr, 1);
+
+	return addr;
+}
+
+/**
+ * @brief zeroes one more block for the pool, meant to be called from the idle loop
+ *
+ * the zeroing runs with interrupts on, so the idle loop can be preempted in the middle.
+ * with sse2 it uses non-temporal stores, which go around the cache: nothing will read
+ * the block until it's handed out, so there's no point in evicting anything for it.
+ *
+ * @return true if a block was added, false if the pool is full or memory is short
+ */
+bool pmm_refill_zeroed()
+{
+	static int nt_stores = -1;
+	if (nt_stores < 0)
+		nt_stores = cpu_has(CPUID_EDX_SSE2);
+
+	if (zero_count >= ZERO_POOL_SIZE)
+		return false;
+
+	// only spare blocks go in the pool, it never takes blocks back from it
+	uintptr_t addr = buddy_alloc(0);
+	if (!addr)
+		return false;
+
+	u32 *p = phys_to_virt(addr);
+
+	if (nt_stores)
+	{
+		for (int i = 0; i < BLOCK_SIZE / 4; i += 4)
+		{
+			asm volatile("movnti %1, (%0)\n\t"
+			             "movnti %1, 4(%0)\n\t"
+			             "movnti %1, 8(%0)\n\t"
+			             "movnti %1, 12(%0)"
+			             :: "r"(p + i), "r"(0) : "memory");
+		}
+
+		// make the stores visible before the block can be handed out
+		asm volatile("sfence" ::: "memory");
+	}
+
+	else
+	{
+		vmm_zero_frames(addr, 1);
+	}
+
+	int mask = disable();
+	bool added = zero_count < ZERO_POOL_SIZE;
+	if (added)
+	{
+		zero_pool[zero_count++] = addr;
+		pages[addr / BLOCK_SIZE].flags |= PG_ZEROED;
+	}
+	restore(mask);
+
+	if (!added)
+		pmm_free(addr, 0);
+
+	return added;
+}
+
+/**
+ * @brief takes a run of blocks off the buddy allocator's free lists
+ * @param order log2 of the number of blocks
+ * @return physical address of the first block, or 0 if there's no free run big enough
+ */
+static uintptr_t buddy_alloc(uint order)
+{
+	int mask = disable();
+
+	// find the smallest free run that can satisfy the request
+	u32 candidates = free_orders >> order;
+	if (candidates == 0)
+	{
+		restore(mask);
+		return 0;
+	}
+
+	uint k = order + __builtin_ctz(candidates);
+	u32 idx = free_lists[k];
+	list_remove(idx, k);
 
-	if (idx < 0)
+	// split the run, giving the upper halves back until it is the requested size
+	while (k > order)
 	{
-		kprintf("pmm_alloc: out of physical memory!\n");
-		return (uintptr_t) -1;
+		k--;
+		list_push(idx + (1 << k), k);
 	}
 
-	BITMAP_SET(mmap, idx);
+	pages[idx].order = order;
+	pages[idx].refs  = 1;
+	pages[idx].flags = 0;
+	pages[idx].owner = NULL;
+	used_blocks += 1 << order;
+
+	restore(mask);
 	return idx * BLOCK_SIZE;
 }
+
+/**
+ * @brief free a run of blocks previously returned by pmm_alloc_order
+ * @param addr physical address of the first block
+ * @param order order the run was allocated with
+ */
+void pmm_free(uintptr_t addr, uint order)
+{
+	u32 idx = addr / BLOCK_SIZE;
+
+	if (addr % BLOCK_SIZE != 0 || idx == 0 || idx >= max_blocks || order > PMM_MAX_ORDER)
+	{
+		kprintf("pmm_free: bad block 0x%x (order %d)\n", addr, order);
+		return;
+	}
+
+	// nobody can fault the copy in swap back in once the block is gone
+	if (!pages[idx].free && (pages[idx].flags & PG_SWAPCACHE))
+		swap_free(pages[idx].swap_entry);
+
+	int mask = disable();
+
+	if (pages[idx].free)
+	{
+		restore(mask);
+		kprintf("pmm_free: double free of 0x%x\n", addr);
+		return;
+	}
+
+	pages[idx].flags = 0;
+	used_blocks -= 1 << order;
+	buddy_insert(idx, order);
+	restore(mask);
+}
+
+/**
+ * @brief takes another reference to an allocated block
+ * blocks start out with a single reference when they are allocated.
+ * copy-on-write sharing takes one more per additional mapping
+ * @param addr physical address of the block
+ */
+void pmm_ref(uintptr_t addr)
+{
+	int mask = disable();
+	pages[addr / BLOCK_SIZE].refs++;
+	restore(mask);
+}
+
+/**
+ * @brief drops a reference to an allocated block, freeing it when the last one goes away
+ * @param addr physical address of the block
+ */
+void pmm_unref(uintptr_t addr)
+{
+	int mask = disable();
+	struct page *b = &pages[addr / BLOCK_SIZE];
+	bool last = --b->refs == 0;
+	restore(mask);
+
+	// large pages are runs allocated with pmm_alloc_order, give the whole run back
+	if (last)
+		pmm_free(addr, b->order);
+}
+
+/**
+ * @brief gets the number of references to an allocated block
+ * @param addr physical address of the block
+ */
+uint pmm_refcount(uintptr_t addr)
+{
+	return pages[addr / BLOCK_SIZE].refs;
+}
+
+/**
+ * @brief gets the bookkeeping of a block, for its flags and owner
+ * @param addr physical address of the block, the first block of a run
+ * @return the block's entry in the page array
+ */
+struct page *pmm_page(uintptr_t addr)
+{
+	return &pages[addr / BLOCK_SIZE];
+}
+
+/**
+ * @brief size of the physical address space the pmm manages
+ * @return address one past the highest byte of available memory
+ */
+uintptr_t pmm_mem_top()
+{
+	return max_blocks * BLOCK_SIZE;
+}
+
+/**
+ * @brief gives a run of blocks to the free lists, merging it with its buddy as far as possible
+ * @param idx first block of the run
+ * @param order order of the run
+ */
+static void buddy_insert(u32 idx, uint order)
+{
+	while (order < PMM_MAX_ORDER)
+	{
+		u32 buddy = idx ^ (1 << order);
+
+		// buddy must be a free run of exactly the same order to merge
+		if (buddy >= max_blocks || !pages[buddy].free || pages[buddy].order != order)
+			break;
+
+		list_remove(buddy, order);
+		idx &= ~(1 << order);
+		order++;
+	}
+
+	list_push(idx, order);
+}
+
+/**
+ * @brief frees the blocks in [first, last) outside of the reserved ranges
+ * @param first first block in the range
+ * @param last block one past the end of the range
+ * @param reserved [start, end) block ranges to carve out
+ * @param n number of reserved ranges
+ */
+static void free_unreserved(u32 first, u32 last, const u32 (*reserved)[2], int n)
+{
+	if (first >= last)
+		return;
+
+	if (n == 0)
+	{
+		free_range(first, last);
+		return;
+	}
+
+	u32 start = reserved[0][0];
+	u32 end   = reserved[0][1];
+
+	// whatever is left on either side of this range may still overlap the others
+	free_unreserved(first, last < start ? last : start, reserved + 1, n - 1);
+	free_unreserved(first > end ? first : end, last, reserved + 1, n - 1);
+}
+
+/**
+ * @brief frees every block in [first, last) as the largest aligned runs that fit
+ * @param first first block in the range
+ * @param last block one past the end of the range
+ */
+static void free_range(u32 first, u32 last)
+{
+	while (first < last)
+	{
+		uint order = 0;
+		while (order < PMM_MAX_ORDER && (first & ((2 << order) - 1)) == 0 && first + (2 << order) <= last)
+			order++;
+
+		used_blocks -= 1 << order;
+		buddy_insert(first, order);
+		first += 1 << order;
+	}
+}
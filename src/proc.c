@@ -9,13 +9,15 @@
  */
 #include <proc.h>
 #include <intr.h>
-#include <kmalloc.h>
 #include <kprintf.h>
 #include <pmm.h>
-#include <pq.h>
-#include <queue.h>
+#include <slab.h>
+#include <swap.h>
+#include <vfs.h>
+#include <vma.h>
 #include <vmm.h>
 
+#include <stdio.h>
 #include <string.h>
 
 // defined in intr.s
@@ -24,21 +26,13 @@ extern u32 isr_end;
 // defined in elf.c
 extern void run_elf();
 
-struct proc *curr;
 struct proc *proctab[NPROC];
 
-// process ready queue
-struct queue *readyq;
-
-// process sleep queue
-struct pq *sleepq;
-
 struct proc nullproc = {
 	.state = PR_RUNNING,
 	.stkptr = 0,
 	.pid = -1,
 	.mask = 0,
-	.wakeup = 0,
 	.name = "null process",
 };
 
@@ -47,20 +41,39 @@ int nproc = 0;
 
 int next_pid = 0;
 
-void proc_init()
-{
-	readyq = newq();
-	sleepq = newpq();
-}
+// an exited process nobody will wait for, freed by the next exit once we're off its kernel stack
+static struct proc *unreaped;
+
+// struct procs carry their kernel stack, so they're big enough that mixing them into the heap fragments it
+static struct kmem_cache *proc_cache;
+
+static void release_resources(struct proc *);
+static int fork_failed(struct proc *);
 
 /**
- * @brief adds a process to the ready queue
- * @param pptr process pointer to ready
+ * @brief finds a free slot in the process table
+ * pids are handed out round robin so a pid isn't reused right after its process is reaped
+ * @return free pid or -1 if the process table is full
  */
-void ready(struct proc *pptr)
+static int alloc_pid()
 {
-	pptr->state = PR_READY;
-	insert(readyq, pptr);
+	for (int i = 0; i < NPROC; i++)
+	{
+		int pid = (next_pid + i) % NPROC;
+		if (!proctab[pid])
+		{
+			next_pid = (pid + 1) % NPROC;
+			return pid;
+		}
+	}
+
+	return -1;
+}
+
+void proc_init()
+{
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc), NULL);
+	sched_init();
 }
 
 struct proc *create_usermode(const char *path)
@@ -75,13 +88,29 @@ struct proc *create_usermode(const char *path)
  */
 struct proc *create(void (*f)(void), const char *name)
 {
-	struct proc *pptr = (struct proc *) kmalloc(sizeof(struct proc));
+	int pid = alloc_pid();
+	if (pid < 0)
+	{
+		kprintf("create: process table is full\n");
+		return NULL;
+	}
+
+	struct proc *pptr = kmem_cache_alloc(proc_cache);
 	strncpy(pptr->name, name, 32);
 	pptr->mask = 0;
 	pptr->pdir = 0;  // 0 means use current page directory (kernel pdir)
+	pptr->vmas = NULL;
 	pptr->state = PR_SUSPENDED;
-	pptr->parent = 0;
+	pptr->parent = -1;    // nobody waits for processes the kernel creates
 	pptr->waiting_for = -1;
+	pptr->exit_status = 0;
+	pptr->rss = pptr->dirty = pptr->wss = 0;
+	pptr->faults = pptr->swapins = 0;
+	pptr->nice = 0;
+	pptr->prio = 0;
+	pptr->slice = sched_quantum(0);
+	pptr->cpu = this_cpu()->id;
+	memset(pptr->ofile, 0, sizeof(pptr->ofile));
 	
 	u32 *kstack = (u32 *) (pptr->kstack + PR_STACKSIZE);
 	pptr->stkbtm = (uintptr_t) kstack;
@@ -151,34 +180,161 @@ struct proc *create(void (*f)(void), const char *name)
 	kstack--; *kstack = 0;               // edi
 
 	pptr->stkptr = (uintptr_t) kstack;
-	pptr->pid = next_pid++;
+	pptr->pid = pid;
 	proctab[pptr->pid] = pptr;
 
 	nproc++;
 	return pptr;
 }
 
+/**
+ * @brief creates the null process of an application processor
+ *
+ * it is the first thing the cpu runs, on the kernel stack in the struct, and it never
+ * leaves the cpu. like the boot cpu's null process it isn't in the process table, so
+ * it is never scheduled, boosted or swapped like the others.
+ *
+ * @param cpu index of the cpu into cpus
+ * @return the null process or NULL if out of memory
+ */
+struct proc *create_idle(int cpu)
+{
+	struct proc *pptr = kmem_cache_alloc(proc_cache);
+	if (!pptr)
+	{
+		kprintf("create_idle: out of memory\n");
+		return NULL;
+	}
+
+	memset(pptr, 0, sizeof(struct proc));
+	sprintf(pptr->name, "null process %d", cpu);
+	pptr->state = PR_RUNNING;
+	pptr->pid = -1;
+	pptr->parent = -1;
+	pptr->waiting_for = -1;
+	pptr->cpu = cpu;
+	pptr->stkbtm = (uintptr_t) (pptr->kstack + PR_STACKSIZE);
+	list_init(&pptr->link);
+
+	return pptr;
+}
+
+/**
+ * @brief terminates the current process
+ *
+ * everything but the struct proc itself is released here. the kernel stack lives inside
+ * the struct and we are still running on it, so the struct is freed by whoever reaps the
+ * process: its parent in waitpid, or the next exiting process if it has no parent.
+ *
+ * @param status exit status handed to the parent
+ */
 void proc_exit(int status)
 {
     kprintf("%s (pid = %d) exited with code %d\n", curr->name, curr->pid, status);
-    // TODO - unmap and free all memory used by the process
+
+	int mask = disable();
+
+	release_resources(curr);
     curr->state = PR_TERMINATED;
+	curr->exit_status = status;
     nproc--;
 
+	// children of this process are left without a parent, the dead ones can go right away
+	for (int i = 0; i < NPROC; i++)
+	{
+		struct proc *child = proctab[i];
+		if (!child || child == curr || child->parent != curr->pid)
+			continue;
+
+		child->parent = -1;
+		if (child->state == PR_TERMINATED)
+			proc_reap(child);
+	}
+
+	if (unreaped)
+	{
+		proc_reap(unreaped);
+		unreaped = NULL;
+	}
+
 	// check if parent process is waiting for this one
-	if (curr->parent != -1)
+	struct proc *parent = curr->parent != -1 ? proctab[curr->parent] : NULL;
+	if (parent && parent->state != PR_TERMINATED)
 	{
-		struct proc *parent = proctab[curr->parent];
 		if (parent->state == PR_WAITING && parent->waiting_for == curr->pid)
 		{
 			parent->waiting_for = -1;
-			ready(parent);
+			sched_wakeup(parent);
 		}
 	}
 
+	else
+	{
+		unreaped = curr;
+	}
+
+	restore(mask);
     sched();
 }
 
+/**
+ * @brief frees a terminated process's struct proc and kernel stack, and its pid
+ * @param pptr terminated process that is not the current process
+ */
+void proc_reap(struct proc *pptr)
+{
+	proctab[pptr->pid] = NULL;
+	kmem_cache_free(proc_cache, pptr);
+}
+
+/**
+ * @brief releases a process's address space and open files
+ *
+ * shared file mappings are written back first, which needs the process's own
+ * address space, so pptr must be the current process
+ */
+static void release_resources(struct proc *pptr)
+{
+	for (int fd = 0; fd < NOFILE; fd++)
+	{
+		if (pptr->ofile[fd])
+			vfs_close(fd);
+	}
+
+	if (!pptr->pdir)
+		return;
+
+	vma_sync(pptr->vmas, 0, KERNEL_BASE);
+	vma_free(&pptr->vmas);
+
+	// get off the address space before freeing it
+	uintptr_t pdir = pptr->pdir;
+	pptr->pdir = 0;
+	asm("mov %0, %%cr3" :: "r"(nullproc.pdir) : "memory");
+	vmm_destroy_address_space(pdir);
+}
+
+/**
+ * @brief undoes a partially built child of proc_fork
+ * @return -1, for proc_fork to return
+ */
+static int fork_failed(struct proc *child)
+{
+	if (child->pdir)
+		vmm_destroy_address_space(child->pdir);
+
+	vma_free(&child->vmas);
+
+	for (int i = 0; i < NOFILE; i++)
+	{
+		if (child->ofile[i])
+			child->ofile[i]->refs--;
+	}
+
+	kmem_cache_free(proc_cache, child);
+	return -1;
+}
+
 /**
  * @brief fork the current process
  * @param regs saved registers from syscall
@@ -193,8 +349,12 @@ int proc_fork(struct registers *regs)
 	u32 user_esp = stack[17];
 	u32 user_ss = stack[18];
 
+	int pid = alloc_pid();
+	if (pid < 0)
+		return -1;
+
 	// Allocate new process struct
-	struct proc *child = (struct proc *) kmalloc(sizeof(struct proc));
+	struct proc *child = kmem_cache_alloc(proc_cache);
 	if (!child)
 		return -1;
 
@@ -203,93 +363,104 @@ int proc_fork(struct registers *regs)
 	strncpy(child->name, curr->name, 32);
 	child->mask = curr->mask;
 	child->state = PR_READY;
-	child->pid = next_pid++;
+	child->pid = pid;
+	child->pdir = 0;
 	child->sbrk = curr->sbrk;
+	child->vmas = vma_dup(curr->vmas);
 	child->ustack = curr->ustack;
-	child->wakeup = 0;
 	child->parent = curr->pid;
 	child->waiting_for = -1;
-
-	// Copy open files
+	child->exit_status = 0;
+	child->rss = child->dirty = child->wss = 0;
+	child->faults = child->swapins = 0;
+	child->nice = curr->nice;
+	child->prio = child->nice;
+	child->slice = sched_quantum(child->prio);
+	child->cpu = curr->cpu;
+
+	// Share open files
 	for (int i = 0; i < NOFILE; i++)
+	{
 		child->ofile[i] = curr->ofile[i];
+		if (child->ofile[i])
+			child->ofile[i]->refs++;
+	}
 
 	// Create new address space
 	uintptr_t child_pdir = vmm_create_address_space();
 	if (!child_pdir)
-	{
-		kfree(child);
-		return -1;
-	}
+		return fork_failed(child);
+
 	child->pdir = child_pdir;
 
-	// Copy user space pages from parent to child
-	// Use PDE 769 for temporary mapping (outside user space 0-767, avoids conflict)
+	// Share user space pages between parent and child copy-on-write.
+	// Only the page tables are copied: every writable private page is made read-only
+	// in both address spaces and the frame gains a reference, and the first
+	// write from either side gets its own copy in vmm_page_fault.
 	u32 *parent_pdir = (u32 *) 0xfffff000;
 	void *page_tables = (void *) 0xffc00000;
-	void *temp_map = (void *)(769 << 22);  // Virtual address for PDE 769, PTE 0
-
-	// Create a page table for PDE 769 if it doesn't exist
-	u32 saved_pde = parent_pdir[769];
-	uintptr_t temp_pt_phys = 0;
+	u32 *child_pd = phys_to_virt(child_pdir);
 
-	if (!(saved_pde & PT_PRESENT))
+	for (int pdi = 0; pdi < 768; pdi++)  // User space PDEs (0-767)
 	{
-		temp_pt_phys = pmm_alloc();
-		if (!temp_pt_phys)
+		if (!(parent_pdir[pdi] & PT_PRESENT))
+			continue;
+
+		// 4M pages aren't shared copy-on-write, a single write would mean copying all of it anyway
+		if (parent_pdir[pdi] & PT_LARGE)
 		{
-			kfree(child);
-			return -1;
-		}
-		parent_pdir[769] = temp_pt_phys | PT_PRESENT | PT_WRITABLE;
-		asm volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" ::: "eax", "memory");
+			uintptr_t copy = pmm_alloc_order(PMM_MAX_ORDER);
+			if (!copy)
+				return fork_failed(child);
 
-		// Zero out the page table
-		u32 *temp_pt = (u32 *)(page_tables + 769 * PAGE_SIZE);
-		for (int i = 0; i < 1024; i++)
-			temp_pt[i] = 0;
-	}
+			vmm_copy_frames(copy, parent_pdir[pdi] & PT_FRAME, LARGE_PAGE_SIZE / PAGE_SIZE);
+			pmm_page(copy)->owner = child;
+			child_pd[pdi] = copy | (parent_pdir[pdi] & ~PT_FRAME);
+			continue;
+		}
 
-	u32 *temp_pt = (u32 *)(page_tables + 769 * PAGE_SIZE);
+		uintptr_t child_pt_phys = pmm_alloc();
+		if (!child_pt_phys)
+			return fork_failed(child);
 
-	for (int pdi = 0; pdi < 768; pdi++)  // User space PDEs (0-767)
-	{
-		if (!(parent_pdir[pdi] & PT_PRESENT))
-			continue;
+		pmm_page(child_pt_phys)->flags |= PG_PAGETABLE;
 
 		u32 *parent_pt = (u32 *)(page_tables + pdi * PAGE_SIZE);
+		u32 *child_pt = phys_to_virt(child_pt_phys);
 
 		for (int pti = 0; pti < 1024; pti++)
 		{
-			if (!(parent_pt[pti] & PT_PRESENT))
-				continue;
-
-			uintptr_t virt = ((u32)pdi << 22) | ((u32)pti << 12);
-			unsigned flags = parent_pt[pti] & 0xfff;
+			u32 pte = parent_pt[pti];
 
-			// Allocate new physical page for child
-			uintptr_t child_phys = pmm_alloc();
-			if (!child_phys)
+			if (pte & PT_PRESENT)
 			{
-				// TODO: cleanup on failure
-				return -1;
-			}
+				// shared file mappings stay shared, both sides keep writing the page cache frame
+				uintptr_t addr = (uintptr_t) pdi << 22 | pti << 12;
+				struct vma *vma = pte & PT_WRITABLE ? vma_find(curr->vmas, addr) : NULL;
+
+				if ((pte & PT_WRITABLE) && !(vma && (vma->flags & VMA_SHARED)))
+				{
+					pte = (pte & ~PT_WRITABLE) | PT_COW;
+					parent_pt[pti] = pte;
+				}
 
-			// Temporarily map child's physical page at PTE 0 in our temp page table
-			temp_pt[0] = child_phys | PT_PRESENT | PT_WRITABLE;
-			asm volatile("invlpg (%0)" :: "r"(temp_map) : "memory");
+				pmm_ref(pte & PT_FRAME);
+			}
 
-			// Copy page contents from parent's virtual address to child's page
-			memcpy(temp_map, (void *) virt, PAGE_SIZE);
+			// pages out in swap are shared through their slot, whoever faults first reads their own copy
+			else if (pte & PT_SWAP)
+			{
+				swap_dup(pte);
+			}
 
-			// Map the new physical page in child's address space
-			vmm_map_page_in_pdir(child_pdir, child_phys, virt, flags);
+			child_pt[pti] = pte;
 		}
+
+		child_pd[pdi] = child_pt_phys | (parent_pdir[pdi] & ~PT_FRAME);
 	}
 
-	// Restore PDE 769
-	parent_pdir[769] = saved_pde;
-	asm volatile("invlpg (%0)" :: "r"(temp_map) : "memory");
+	// the parent's writable pages just became read-only, so its stale TLB entries must go
+	asm volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" ::: "eax", "memory");
 
 	// Set up child's kernel stack
 	u32 *kstack = (u32 *) (child->kstack + PR_STACKSIZE);
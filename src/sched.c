@@ -6,19 +6,317 @@
  * FILE: sched.c
  * DATE: August 9, 2021
  * DESCRIPTION: pick the next eligible process to run
+ *
+ * Ready processes wait on one of NPRIO queues, a multilevel feedback queue. The highest
+ * nonempty level always runs first, round robin within a level. A process gets a quantum
+ * of SCHED_QUANTUM ms at the top level and twice as much at each level below, and once it
+ * has run for all of it, however many times it blocked in between, it drops a level.
+ * Processes that wake up from waiting on input go back to their base level, so interactive
+ * ones stay near the top while cpu bound ones sink, and every SCHED_BOOST_MS everybody is
+ * put back on their base level so the bottom doesn't starve.
+ *
+ * There is no fixed tick. Whenever the cpu changes hands the time since the last charge is
+ * read off the clock and charged to the process giving it up, and the clock is programmed
+ * for the end of the new process's quantum.
+ *
+ * Every cpu has queues of its own. A readied process goes on the queue of the cpu it last
+ * ran on, unless another cpu has less to do, and a cpu that would otherwise go idle takes
+ * a process off the busiest queue. A cpu is interrupted when a process is readied for it
+ * while it is idle, or while it runs something on a lower level.
  */
 
+#include <clk.h>
 #include <intr.h>
 #include <kprintf.h>
+#include <list.h>
+#include <pmm.h>
 #include <proc.h>
-#include <queue.h>
+#include <smp.h>
 
 extern struct proc *proctab[];
-extern struct proc *curr;
 extern struct proc nullproc;
 extern int nproc;
-extern struct queue *readyq;
 
+struct runqueue
+{
+	struct list_head readyq[NPRIO];    // processes ready to run, linked through their struct proc
+	u32 ready_levels;                  // bit n is set when readyq[n] is nonempty
+	int nready;                        // number of processes on the queues
+};
+
+static struct runqueue runqueues[NCPU];
+
+// uptime of the next boost
+static u32 boost_at = SCHED_BOOST_MS;
+
+static void resched();
+
+void sched_init()
+{
+	for (int cpu = 0; cpu < NCPU; cpu++)
+	{
+		for (int i = 0; i < NPRIO; i++)
+			list_init(&runqueues[cpu].readyq[i]);
+	}
+
+	set_vect(IPI_RESCHED, resched);
+}
+
+static void enqueue(int cpu, struct proc *pptr)
+{
+	struct runqueue *rq = &runqueues[cpu];
+
+	list_append(&rq->readyq[pptr->prio], &pptr->link);
+	rq->ready_levels |= 1 << pptr->prio;
+	rq->nready++;
+	pptr->cpu = cpu;
+}
+
+static struct proc *dequeue(int cpu, int level)
+{
+	struct runqueue *rq = &runqueues[cpu];
+	struct proc *pptr = list_entry(list_pop_front(&rq->readyq[level]), struct proc, link);
+
+	if (list_empty(&rq->readyq[level]))
+		rq->ready_levels &= ~(1 << level);
+
+	rq->nready--;
+	return pptr;
+}
+
+/**
+ * @brief how much a cpu has to do, its ready processes and the one it is running
+ */
+static int load(int cpu)
+{
+	struct cpu *c = &cpus[cpu];
+	return runqueues[cpu].nready + (c->proc != c->idle);
+}
+
+/**
+ * @brief picks the cpu a process should run on
+ * it stays on the cpu it last ran on, where its cache is warm, unless another cpu has less to do
+ */
+static int pick_cpu(struct proc *pptr)
+{
+	int best = cpus[pptr->cpu].online ? pptr->cpu : this_cpu()->id;
+
+	for (int cpu = 0; cpu < ncpu; cpu++)
+	{
+		if (cpus[cpu].online && load(cpu) < load(best))
+			best = cpu;
+	}
+
+	return best;
+}
+
+/**
+ * @brief adds a process to the ready queue of its level, on the cpu it should run on
+ * @param pptr process pointer to ready
+ */
+void ready(struct proc *pptr)
+{
+	int cpu = pick_cpu(pptr);
+	struct cpu *c = &cpus[cpu];
+
+	pptr->state = PR_READY;
+	enqueue(cpu, pptr);
+
+	// an idle cpu is halted until its next interrupt, and a busy one only checks its queues when its quantum is up
+	if (c != this_cpu() && (c->proc == c->idle || pptr->prio < c->proc->prio))
+		smp_resched(cpu);
+}
+
+/**
+ * @brief length of the quantum at a level
+ * @param prio level
+ * @return quantum in ms
+ */
+u32 sched_quantum(int prio)
+{
+	return SCHED_QUANTUM << prio;
+}
+
+/**
+ * @brief finds the highest level of a cpu's queues with a process ready to run
+ * @return the level or -1 if nothing is ready
+ */
+static int top_level(int cpu)
+{
+	u32 levels = runqueues[cpu].ready_levels;
+	return levels ? __builtin_ctz(levels) : -1;
+}
+
+/**
+ * @brief takes a process off the busiest other cpu's queues, for a cpu that has run out of its own
+ * @param cpu cpu to move the process to
+ * @return level of the process, now on cpu's queue, or -1 if no other cpu had one waiting
+ */
+static int steal(int cpu)
+{
+	int busiest = -1;
+	for (int i = 0; i < ncpu; i++)
+	{
+		if (i != cpu && runqueues[i].nready > 0 && (busiest < 0 || runqueues[i].nready > runqueues[busiest].nready))
+			busiest = i;
+	}
+
+	if (busiest < 0)
+		return -1;
+
+	struct proc *pptr = dequeue(busiest, top_level(busiest));
+	enqueue(cpu, pptr);
+	return pptr->prio;
+}
+
+/**
+ * @brief checks whether this cpu has a process it could run, for the idle loop
+ * the other cpus' queues count too, whatever is waiting there can be stolen
+ */
+bool sched_pending()
+{
+	for (int cpu = 0; cpu < ncpu; cpu++)
+	{
+		if (runqueues[cpu].nready > 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief puts a process back on its base level with a fresh quantum
+ */
+static void reset(struct proc *pptr)
+{
+	pptr->prio  = pptr->nice;
+	pptr->slice = sched_quantum(pptr->prio);
+}
+
+/**
+ * @brief moves every process back to its base level, on every cpu
+ */
+static void boost()
+{
+	for (int i = 0; i < NPROC; i++)
+	{
+		if (proctab[i])
+			reset(proctab[i]);
+	}
+
+	for (int cpu = 0; cpu < ncpu; cpu++)
+	{
+		// gather everybody up in priority order, then put them back on their new levels
+		struct list_head all;
+		list_init(&all);
+
+		while (runqueues[cpu].ready_levels)
+			list_append(&all, &dequeue(cpu, top_level(cpu))->link);
+
+		struct list_head *node;
+		while ((node = list_pop_front(&all)))
+			enqueue(cpu, list_entry(node, struct proc, link));
+	}
+}
+
+/**
+ * @brief readies a process that was waiting for input or another process
+ * it goes back to its base level, waiting is what interactive processes do
+ * @param pptr process to wake up
+ */
+void sched_wakeup(struct proc *pptr)
+{
+	reset(pptr);
+	ready(pptr);
+}
+
+/**
+ * @brief charges a process for the time it has had the cpu
+ * @param pptr process that has been running, it must not be on a ready queue
+ * @param n ms it has been running for
+ * @return true if its quantum ran out, dropping it a level
+ */
+static bool charge(struct proc *pptr, u32 n)
+{
+	u32 now = uptime();
+	if ((s32) (now - boost_at) >= 0)
+	{
+		boost_at = now + SCHED_BOOST_MS;
+		boost();
+	}
+
+	// the null process runs only when nothing else can, the idle loop takes care of it
+	if (pptr == this_cpu()->idle || n == 0)
+		return false;
+
+	if (n < pptr->slice)
+	{
+		pptr->slice -= n;
+		return false;
+	}
+
+	if (pptr->prio < NPRIO - 1)
+		pptr->prio++;
+
+	pptr->slice = sched_quantum(pptr->prio);
+	return true;
+}
+
+/**
+ * @brief charges the running process for the time since the last clock interrupt
+ * the process is preempted once its quantum is used up, dropping a level,
+ * or as soon as a process on a higher level is ready
+ * @param n ms since the last charge
+ */
+void sched_tick(u32 n)
+{
+	if (charge(curr, n))
+	{
+		sched();
+		return;
+	}
+
+	if (curr == this_cpu()->idle)
+		return;
+
+	int level = top_level(this_cpu()->id);
+	if (level >= 0 && level < curr->prio)
+		sched();
+}
+
+/**
+ * @brief another cpu readied a process for this one
+ */
+static void resched()
+{
+	sched_tick(clk_take());
+	clk_rearm();
+}
+
+/**
+ * @brief how long the scheduler can go without hearing from the clock
+ * @return ms left of the running process's quantum, or until the next boost if that is sooner
+ */
+u32 sched_next()
+{
+	// nothing to preempt, the null process gives the cpu up as soon as something is ready
+	if (curr == this_cpu()->idle)
+		return (u32) -1;
+
+	s32 boost_left = boost_at - uptime();
+	if (boost_left < 1)
+		boost_left = 1;
+
+	return curr->slice < (u32) boost_left ? curr->slice : (u32) boost_left;
+}
+
+/**
+ * @brief gives the cpu to the process that should be running
+ *
+ * a running process keeps going unless a process on its level or a higher one is ready,
+ * in which case it goes to the back of its level's queue. processes run on the level
+ * they were readied on, or the null process if nothing is ready.
+ */
 void sched()
 {
 	struct proc *pold = curr;
@@ -27,16 +325,36 @@ void sched()
 	// save current interrupt state into current process's mask
 	pold->mask = disable();
 
-	if (is_empty(readyq))
+	struct cpu *c = this_cpu();
+
+	// before pold is put back on a queue, its level may change
+	charge(pold, clk_take());
+
+	int level = top_level(c->id);
+	bool running = pold != c->idle && pold->state == PR_RUNNING;
+
+	// rather than going idle, help out a busier cpu
+	if (level < 0 && !running)
+		level = steal(c->id);
+
+	if (level < 0 || (running && level > pold->prio))
 	{
 		if (pold->state != PR_RUNNING)
-			pnew = &nullproc;
+			pnew = c->idle;
 		else
 			pnew = curr;
 	}
 
 	else
-		pnew = (struct proc *) dequeue(readyq);
+	{
+		if (running)
+		{
+			pold->state = PR_READY;
+			enqueue(c->id, pold);
+		}
+
+		pnew = dequeue(c->id, level);
+	}
 
 	if (pnew == pold)
 	{
@@ -44,20 +362,41 @@ void sched()
 		return;
 	}
 
-	if (pold != &nullproc && pold->state == PR_RUNNING)
-	{
-		pold->state = PR_READY;
-		insert(readyq, pold);
-	}
-
 	curr = pnew;
 	curr->state = PR_RUNNING;
+	curr->cpu = c->id;
+	clk_rearm();
 
-	// Switch page directory if new process has one
-	// (null process has pdir set to kernel page directory)
-	if (pnew->pdir != 0)
-		asm("mov %0, %%cr3" :: "r"(pnew->pdir) : "memory");
+	// Switch page directory, processes without one of their own run in the kernel's
+	// (null process has pdir set to kernel page directory). staying in the previous
+	// process's address space isn't safe, it is freed as soon as that process exits
+	uintptr_t pdir = pnew->pdir ? pnew->pdir : nullproc.pdir;
+	asm("mov %0, %%cr3" :: "r"(pdir) : "memory");
 
+	// pold may be picked up by another cpu as soon as this one gives the kernel lock up,
+	// which it can't do before ctxsw is done saving pold's registers
 	ctxsw(pold, pnew);
 	restore(pold->mask);
 }
+
+/**
+ * @brief the null process's loop, every cpu ends up here once it is running
+ * idle time goes into zeroing blocks ahead of time, and the cpu is handed over as soon as anything is ready
+ */
+void sched_idle()
+{
+	while (1)
+	{
+		if (sched_pending())
+			sched();
+		else if (!pmm_refill_zeroed())
+		{
+			// halt turns interrupts on and waits in one go, so nothing readied
+			// between the check and the hlt can leave us waiting for the next interrupt
+			int mask = disable();
+			if (!sched_pending())
+				halt();
+			restore(mask);
+		}
+	}
+}
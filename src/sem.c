@@ -14,14 +14,13 @@
 #include <kprintf.h>
 #include <proc.h>
 
-extern struct proc *curr;
 
 struct sem sem;
 
 void sem_init()
 {
 	sem.count = 0;
-	sem.waitq = newq();
+	list_init(&sem.waitq);
 }
 
 void wait()
@@ -30,7 +29,7 @@ void wait()
 	if (--sem.count < 0)
 	{
 		curr->state = PR_WAITING;
-		insert(sem.waitq, curr);
+		list_append(&sem.waitq, &curr->link);
 		sched();
 	}
 	restore(mask);
@@ -41,14 +40,14 @@ void signal()
 	int mask = disable();
 	if (++sem.count >= 0)
 	{
-		struct proc *pptr = (struct proc *) dequeue(sem.waitq);
-		if (!pptr)
+		struct list_head *node = list_pop_front(&sem.waitq);
+		if (!node)
 		{
 			restore(mask);
 			return;
 		}
 
-		ready(pptr);
+		sched_wakeup(list_entry(node, struct proc, link));
 		sched();
 	}
 	restore(mask);
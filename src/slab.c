@@ -0,0 +1,286 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: slab.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: object caches for fixed-size kernel objects
+ */
+#include <slab.h>
+
+#include <intr.h>
+#include <kmalloc.h>
+#include <kprintf.h>
+#include <kprof.h>
+#include <pmm.h>
+#include <vmm.h>
+
+// every cache that has been created
+static struct kmem_cache *caches;
+
+static inline size_t slab_bytes(struct kmem_cache *cache)
+{
+	return BLOCK_SIZE << cache->order;
+}
+
+/**
+ * @brief works out how many objects of a given size fit in a slab of a given order
+ * @param size object size
+ * @param order slab order
+ * @param objs_off set to the offset of the first object from the start of the slab
+ */
+static uint fit(size_t size, uint order, size_t *objs_off)
+{
+	size_t bytes = BLOCK_SIZE << order;
+
+	// each object costs its size plus a slot on the free stack
+	uint n = (bytes - sizeof(struct slab)) / (size + sizeof(u16));
+
+	// rounding the start of the objects up may push the last one past the end
+	while (n > 0)
+	{
+		*objs_off = (sizeof(struct slab) + n * sizeof(u16) + 7) & ~7;
+		if (*objs_off + n * size <= bytes)
+			break;
+
+		n--;
+	}
+
+	return n;
+}
+
+/**
+ * @brief creates a cache of fixed-size objects
+ *
+ * slabs are made as small as they can be while wasting no more than an eighth of their
+ * space, so small objects live in single blocks and big ones get a few blocks to share.
+ * objects with a constructor should be given back to kmem_cache_free in their constructed state.
+ *
+ * @param name name of the cache, for print_slabinfo
+ * @param size size of each object in bytes
+ * @param ctor called on every object when its slab is created, or NULL
+ * @return the cache or NULL if objects of this size are too big for a slab
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	size = (size + 7) & ~7;
+
+	uint order;
+	uint per_slab = 0;
+	size_t objs_off;
+
+	for (order = 0; order <= SLAB_MAX_ORDER; order++)
+	{
+		per_slab = fit(size, order, &objs_off);
+		size_t waste = (BLOCK_SIZE << order) - per_slab * size;
+
+		if (per_slab > 0 && waste * 8 <= (size_t) (BLOCK_SIZE << order))
+			break;
+	}
+
+	// nothing wasted little enough, settle for the biggest slab
+	if (order > SLAB_MAX_ORDER)
+	{
+		order = SLAB_MAX_ORDER;
+		per_slab = fit(size, order, &objs_off);
+	}
+
+	if (per_slab == 0)
+	{
+		kprintf("kmem_cache_create: %s objects of %d bytes don't fit in a slab\n", name, size);
+		return NULL;
+	}
+
+	struct kmem_cache *cache = kmalloc(sizeof(struct kmem_cache));
+	if (!cache)
+		return NULL;
+
+	cache->name     = name;
+	cache->size     = size;
+	cache->order    = order;
+	cache->per_slab = per_slab;
+	cache->ctor     = ctor;
+	cache->partial  = NULL;
+	cache->full     = NULL;
+	cache->empty    = NULL;
+	cache->allocs   = 0;
+	cache->frees    = 0;
+	cache->active   = 0;
+	cache->slabs    = 0;
+
+	int mask = disable();
+	cache->next = caches;
+	caches = cache;
+	restore(mask);
+
+	return cache;
+}
+
+static void list_add(struct slab **list, struct slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+
+	if (*list)
+		(*list)->prev = slab;
+
+	*list = slab;
+}
+
+static void list_remove(struct slab **list, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+/**
+ * @brief gives a cache a new empty slab
+ * @return the slab or NULL if out of physical memory
+ */
+static struct slab *grow(struct kmem_cache *cache)
+{
+	uintptr_t phys = pmm_alloc_order(cache->order);
+	if (!phys)
+		return NULL;
+
+	pmm_page(phys)->flags |= PG_LOCKED;
+
+	// buddy blocks are aligned to their size, which is how kmem_cache_free finds the slab of an object
+	struct slab *slab = phys_to_virt(phys);
+	size_t objs_off;
+	fit(cache->size, cache->order, &objs_off);
+
+	slab->cache = cache;
+	slab->objs  = (void *) slab + objs_off;
+	slab->nfree = cache->per_slab;
+
+	// lowest objects on top, so a fresh slab hands them out in address order
+	for (uint i = 0; i < cache->per_slab; i++)
+	{
+		slab->free[i] = cache->per_slab - 1 - i;
+
+		if (cache->ctor)
+			cache->ctor(slab->objs + i * cache->size);
+	}
+
+	list_add(&cache->empty, slab);
+	cache->slabs++;
+	return slab;
+}
+
+/**
+ * @brief allocates an object from a cache
+ * @param cache cache to allocate from
+ * @return the object or NULL if out of memory
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	int mask = disable();
+
+	// fill up partial slabs before starting on empty ones, so empty ones can be given back
+	struct slab *slab = cache->partial;
+	if (!slab)
+	{
+		slab = cache->empty ? cache->empty : grow(cache);
+		if (!slab)
+		{
+			restore(mask);
+			kprintf("kmem_cache_alloc: out of memory for %s\n", cache->name);
+			return NULL;
+		}
+
+		list_remove(&cache->empty, slab);
+		list_add(&cache->partial, slab);
+	}
+
+	void *obj = slab->objs + slab->free[--slab->nfree] * cache->size;
+
+	if (slab->nfree == 0)
+	{
+		list_remove(&cache->partial, slab);
+		list_add(&cache->full, slab);
+	}
+
+	cache->allocs++;
+	cache->active++;
+
+	restore(mask);
+	kprof_alloc(obj, cache->size);
+	return obj;
+}
+
+/**
+ * @brief gives an object back to its cache
+ *
+ * one empty slab is kept around so a cache going back and forth across a slab
+ * boundary doesn't hit the pmm every time, any more are freed
+ *
+ * @param cache cache the object was allocated from
+ * @param obj object to free
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	if (!obj)
+		return;
+
+	struct slab *slab = (struct slab *) ((uintptr_t) obj & ~(slab_bytes(cache) - 1));
+	if (slab->cache != cache)
+	{
+		kprintf("kmem_cache_free: 0x%x is not a %s object\n", obj, cache->name);
+		return;
+	}
+
+	kprof_free(obj);
+
+	int mask = disable();
+
+	if (slab->nfree == 0)
+	{
+		list_remove(&cache->full, slab);
+		list_add(&cache->partial, slab);
+	}
+
+	slab->free[slab->nfree++] = (obj - slab->objs) / cache->size;
+	cache->frees++;
+	cache->active--;
+
+	if (slab->nfree == cache->per_slab)
+	{
+		list_remove(&cache->partial, slab);
+
+		if (cache->empty)
+		{
+			pmm_free(virt_to_phys(slab), cache->order);
+			cache->slabs--;
+		}
+
+		else
+		{
+			list_add(&cache->empty, slab);
+		}
+	}
+
+	restore(mask);
+}
+
+/**
+ * @brief prints the statistics of every cache
+ */
+void print_slabinfo()
+{
+	kprintf("\tSLABINFO\n");
+	// vsprintf has no field widths to line columns up with, so fields are just separated by spaces
+	kprintf("name: size per_slab slabs active allocs frees\n");
+
+	for (struct kmem_cache *cache = caches; cache; cache = cache->next)
+	{
+		kprintf("%s: %d %d %d %d %d %d\n", cache->name, cache->size, cache->per_slab,
+			cache->slabs, cache->active, cache->allocs, cache->frees);
+	}
+}
@@ -0,0 +1,319 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: smp.c
+ * DATE: October 18th, 2026
+ * DESCRIPTION: per cpu data and bringing up the other cpus
+ *
+ * The processors are found in the ACPI MADT. Each application processor is started with
+ * INIT and two STARTUP ipis, comes in through trampoline.s, loads its own gdt and tss and
+ * runs its null process, and from then on schedules processes like the boot cpu does.
+ */
+#include <smp.h>
+
+#include <acpi.h>
+#include <clk.h>
+#include <cpu.h>
+#include <idt.h>
+#include <intr.h>
+#include <kprintf.h>
+#include <lapic.h>
+#include <proc.h>
+#include <spinlock.h>
+#include <vmm.h>
+
+#include <string.h>
+
+// defined in trampoline.s
+extern u8 ap_trampoline[], ap_trampoline_args[], ap_trampoline_end[];
+
+// defined in start.s - initial kernel stack
+extern u32 kstack_top;
+
+extern struct proc nullproc;
+
+// what an application processor needs to get into the kernel, at ap_trampoline_args
+struct ap_args
+{
+	u32 cr3;      // kernel page directory
+	u32 cr4;      // pse and pge, as the boot cpu has them
+	u32 stack;    // top of the cpu's null process's kernel stack
+	u32 entry;    // ap_main
+	u32 cpu;      // struct cpu, passed to ap_main
+};
+
+struct cpu cpus[NCPU];
+int ncpu = 1;
+
+// held by the cpu that has interrupts off, see smp.h
+static struct spinlock klock;
+
+// bumped whenever kernel pages are unmapped, a cpu whose tlb_gen is behind flushes its tlb
+static volatile u32 kernel_tlb_gen;
+
+static void ap_main(struct cpu *);
+
+/**
+ * @brief encodes a gdt entry
+ * @param base first address of the segment
+ * @param limit last offset into the segment, in pages if flags has the granularity bit
+ * @param access access byte: present, privilege level, type
+ * @param flags granularity and size bits
+ */
+static u64 segment(u32 base, u32 limit, u8 access, u8 flags)
+{
+	return (u64) (limit & 0xffff)
+	     | (u64) (base & 0xffffff) << 16
+	     | (u64) access << 40
+	     | (u64) (limit >> 16 & 0xf) << 48
+	     | (u64) (flags & 0xf) << 52
+	     | (u64) (base >> 24) << 56;
+}
+
+/**
+ * @brief fills in a cpu's struct, its gdt and tss
+ * @param c struct to fill in
+ * @param id index of c into cpus
+ * @param apic_id id of the cpu's local apic
+ */
+static void cpu_setup(struct cpu *c, int id, u8 apic_id)
+{
+	memset(c, 0, sizeof(struct cpu));
+	c->self    = c;
+	c->id      = id;
+	c->apic_id = apic_id;
+
+	// the same flat segments as start.s, then the cpu's own tss and per cpu segment
+	c->gdt[SEL_KCODE / 8]  = segment(0, 0xfffff, 0x9a, 0xc);
+	c->gdt[SEL_KDATA / 8]  = segment(0, 0xfffff, 0x92, 0xc);
+	c->gdt[SEL_UCODE / 8]  = segment(0, 0xfffff, 0xfa, 0xc);
+	c->gdt[SEL_UDATA / 8]  = segment(0, 0xfffff, 0xf2, 0xc);
+	c->gdt[SEL_TSS / 8]    = segment((u32) &c->tss, sizeof(struct tss) - 1, 0x89, 0);
+	c->gdt[SEL_PERCPU / 8] = segment((u32) c, sizeof(struct cpu) - 1, 0x92, 0x4);
+
+	c->tss.ss0   = SEL_KDATA;
+	c->tss.iomap = sizeof(struct tss);
+}
+
+/**
+ * @brief loads a cpu's gdt and tss on the cpu this is running on
+ */
+static void cpu_load(struct cpu *c)
+{
+	struct
+	{
+		u16 limit;
+		u32 base;
+	} __attribute__((packed)) gdtr = { sizeof(c->gdt) - 1, (u32) c->gdt };
+
+	asm volatile("lgdt %0\n\t"
+	             "ljmp %1, $1f\n"
+	             "1:\n\t"
+	             "mov %w2, %%ds\n\t"
+	             "mov %w2, %%es\n\t"
+	             "mov %w2, %%fs\n\t"
+	             "mov %w2, %%ss\n\t"
+	             "mov %w3, %%gs\n\t"
+	             "ltr %w4"
+	             :: "m"(gdtr), "i"(SEL_KCODE), "r"(SEL_KDATA), "r"(SEL_PERCPU), "r"(SEL_TSS)
+	             : "memory");
+}
+
+/**
+ * @brief flushes the whole tlb of the cpu this is running on, global kernel pages included
+ */
+static void flush_tlb_all()
+{
+	u32 cr4 = read_cr4();
+
+	// global entries only go when pge is turned off
+	if (cr4 & CR4_PGE)
+	{
+		write_cr4(cr4 & ~CR4_PGE);
+		write_cr4(cr4);
+	}
+
+	else
+	{
+		asm volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" ::: "eax", "memory");
+	}
+}
+
+/**
+ * @brief takes the kernel lock, called with interrupts off
+ * use disable() instead, it takes the lock when it turns interrupts off
+ */
+void klock_acquire()
+{
+	spin_lock(&klock);
+
+	// another cpu may have unmapped kernel pages this one still has in its tlb
+	struct cpu *c = this_cpu();
+	if (c->tlb_gen != kernel_tlb_gen)
+	{
+		c->tlb_gen = kernel_tlb_gen;
+		flush_tlb_all();
+	}
+}
+
+/**
+ * @brief gives the kernel lock up, right before interrupts go back on
+ */
+void klock_release()
+{
+	spin_unlock(&klock);
+}
+
+/**
+ * @brief called once kernel pages have been unmapped and invalidated on this cpu,
+ * the other cpus flush their tlbs before they next take the kernel lock.
+ * until then they only run user code or the idle loop, neither of which touches them
+ */
+void smp_kernel_unmapped()
+{
+	kernel_tlb_gen++;
+	this_cpu()->tlb_gen = kernel_tlb_gen;
+}
+
+/**
+ * @brief sets the kernel stack the cpu switches to on an interrupt from user mode
+ * @param esp top of the running process's kernel stack
+ */
+void set_task(u32 esp)
+{
+	this_cpu()->tss.esp0 = esp;
+}
+
+/**
+ * @brief interrupts a cpu so it looks at its ready queues
+ * @param cpu index into cpus
+ */
+void smp_resched(int cpu)
+{
+	lapic_ipi(cpus[cpu].apic_id, ICR_FIXED | ICR_ASSERT | IPI_RESCHED);
+}
+
+/**
+ * @brief sets up the boot cpu's struct cpu, before anything else runs
+ * interrupts are off, so it takes the kernel lock
+ */
+void smp_early_init()
+{
+	struct cpu *c = &cpus[0];
+
+	// the apic id is filled in by smp_init, once the local apic is mapped
+	cpu_setup(c, 0, 0);
+	c->proc = c->idle = &nullproc;
+	c->tss.esp0 = (u32) &kstack_top;
+	c->started = true;
+	c->online  = true;
+
+	cpu_load(c);
+	klock_acquire();
+}
+
+/**
+ * @brief starts an application processor and waits for it to come in
+ * @param c the cpu's struct cpu, filled in
+ * @return true if it made it out of the trampoline
+ */
+static bool start_ap(struct cpu *c)
+{
+	struct ap_args *args = phys_to_virt(AP_TRAMPOLINE) + (ap_trampoline_args - ap_trampoline);
+	args->cr3   = nullproc.pdir;
+	args->cr4   = read_cr4();
+	args->stack = c->idle->stkbtm;
+	args->entry = (u32) ap_main;
+	args->cpu   = (u32) c;
+
+	// INIT, then STARTUP twice, as the multiprocessor spec has it
+	lapic_ipi(c->apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+	clk_delay(10);
+
+	for (int i = 0; i < 2 && !c->started; i++)
+	{
+		lapic_ipi(c->apic_id, ICR_STARTUP | AP_TRAMPOLINE >> 12);
+		clk_delay(1);
+	}
+
+	for (int i = 0; i < 100 && !c->started; i++)
+		clk_delay(1);
+
+	return c->started;
+}
+
+/**
+ * @brief finds the other cpus and starts them, at the end of init
+ * they wait for the kernel lock until the boot cpu turns interrupts on
+ */
+void smp_init()
+{
+	u8 apic_ids[NCPU];
+	uintptr_t lapic_phys;
+
+	int n = acpi_find_cpus(apic_ids, NCPU, &lapic_phys);
+	if (n < 0 || !cpu_has(CPUID_EDX_APIC))
+	{
+		kprintf("smp: no local apic found, running on one cpu\n");
+		return;
+	}
+
+	if (lapic_setup(lapic_phys) < 0)
+		return;
+
+	lapic_init();
+	lapic_calibrate();
+	cpus[0].apic_id = lapic_id();
+
+	memcpy(phys_to_virt(AP_TRAMPOLINE), ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+	for (int i = 0; i < n && ncpu < NCPU; i++)
+	{
+		if (apic_ids[i] == cpus[0].apic_id)
+			continue;
+
+		struct proc *idle = create_idle(ncpu);
+		if (!idle)
+			break;
+
+		struct cpu *c = &cpus[ncpu];
+		cpu_setup(c, ncpu, apic_ids[i]);
+		c->proc = c->idle = idle;
+		c->tss.esp0 = idle->stkbtm;
+
+		// whatever went wrong with this one would likely go wrong with the rest
+		if (!start_ap(c))
+		{
+			kprintf("smp: cpu with apic id %d didn't start\n", apic_ids[i]);
+			break;
+		}
+
+		ncpu++;
+	}
+
+	kprintf("smp: %d cpu(s)\n", ncpu);
+}
+
+/**
+ * @brief where an application processor comes in from the trampoline
+ * @param c the cpu's struct cpu
+ */
+static void ap_main(struct cpu *c)
+{
+	cpu_load(c);
+	idt_load();
+	lapic_init();
+
+	// the boot cpu is waiting on this, and keeps the kernel lock until it is done with init
+	c->started = true;
+	klock_acquire();
+
+	c->charged_at = uptime();
+	c->online = true;
+	kprintf("smp: cpu %d (apic id %d) is up\n", c->id, c->apic_id);
+
+	enable();
+	sched_idle();
+}
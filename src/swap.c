@@ -0,0 +1,417 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: swap.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: paging anonymous user memory out to disk
+ */
+#include <swap.h>
+
+#include <ata.h>
+#include <ext2.h>
+#include <intr.h>
+#include <kprintf.h>
+#include <pmm.h>
+#include <proc.h>
+#include <vfs.h>
+#include <vma.h>
+#include <vmalloc.h>
+#include <vmm.h>
+#include <zram.h>
+
+#include <string.h>
+
+extern struct proc *proctab[];
+
+// filesystem blocks making up a slot
+#define BLOCKS_PER_SLOT (PAGE_SIZE / EXT2_BLOCK_SIZE)
+
+// disk block behind every filesystem block of the swap file, looked up once so paging never touches ext2
+static u32 *blocks;
+
+// number of ptes (and swap cached frames) referring to each slot, forked children share slots with their parent.
+// wide enough that a slot shared by every process there can be never wraps back to free
+static u16 *slot_refs;
+
+static u32 nslots;
+static u32 nfree;
+
+// where the next search for a free slot starts
+static u32 slot_hint;
+
+// position of the clock hand: a process and the next user address in it to look at
+static int hand_pid;
+static uintptr_t hand_addr;
+
+static bool scan(struct proc *);
+static bool evict(struct proc *, uintptr_t, u32 *);
+
+/**
+ * @brief moves a page between memory and its slot
+ * @param slot slot to read or write
+ * @param buff page sized buffer
+ * @param write true to write buff out to the slot, false to read the slot into buff
+ */
+static void slot_io(u32 slot, void *buff, bool write)
+{
+	for (uint i = 0; i < BLOCKS_PER_SLOT; i++)
+	{
+		u32 lba = blocks[slot * BLOCKS_PER_SLOT + i] * EXT2_SECTORS_PER_BLOCK;
+		void *p = buff + i * EXT2_BLOCK_SIZE;
+
+		if (write)
+			ata_write(p, lba, EXT2_SECTORS_PER_BLOCK);
+		else
+			ata_read(p, lba, EXT2_SECTORS_PER_BLOCK);
+	}
+}
+
+/**
+ * @brief finds a free slot and takes a reference to it
+ * @return the slot or -1 if swap is full
+ */
+static int slot_alloc()
+{
+	if (nfree == 0)
+		return -1;
+
+	for (u32 i = 0; i < nslots; i++)
+	{
+		u32 slot = (slot_hint + i) % nslots;
+		if (slot_refs[slot] == 0)
+		{
+			slot_refs[slot] = 1;
+			slot_hint = slot + 1;
+			nfree--;
+			return slot;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief finds the swap file and works out where its slots are on disk
+ * without the file the kernel runs as before, failing allocations once memory is gone
+ */
+void swap_init()
+{
+	struct vnode *node = vfs_lookup(SWAP_FILE);
+	if (!node)
+	{
+		kprintf("swap: no %s, running without swap\n", SWAP_FILE);
+		return;
+	}
+
+	u32 n = ext2_filesize(node->inode) / PAGE_SIZE;
+	if (n == 0)
+	{
+		kprintf("swap: %s is too small, running without swap\n", SWAP_FILE);
+		return;
+	}
+
+	u32 *blk = ext2_data_blocks(node->inode, 0, n * BLOCKS_PER_SLOT);
+
+	// a hole has no disk block behind it, the file has to be written out in full
+	for (u32 i = 0; i < n * BLOCKS_PER_SLOT; i++)
+	{
+		if (blk[i] == 0)
+		{
+			kprintf("swap: %s is sparse, running without swap\n", SWAP_FILE);
+			kvfree(blk);
+			return;
+		}
+	}
+
+	u16 *refs = kvmalloc(n * sizeof(u16));
+	if (!refs)
+	{
+		kvfree(blk);
+		return;
+	}
+
+	memset(refs, 0, n * sizeof(u16));
+
+	blocks    = blk;
+	slot_refs = refs;
+	nslots    = n;
+	nfree     = n;
+
+	kprintf("swap: %d pages on %s\n", n, SWAP_FILE);
+}
+
+/**
+ * @brief frees one block of memory by moving user pages out to swap
+ *
+ * the clock hand moves through the user page tables of every process, reached through
+ * the direct map so no address space has to be switched to. a page the hand finds with
+ * PT_ACCESSED set gets a second chance: the bit is cleared and the page is skipped, and
+ * if it hasn't been touched by the time the hand comes around again it is evicted.
+ * a page that zram keeps in its own block frees nothing yet, so the hand keeps going
+ * until a block is actually freed, stopping after going around twice, by then every
+ * page has had its chance.
+ *
+ * @return true if a block was freed, false if nothing could be evicted
+ */
+bool swap_out()
+{
+	// evicting allocates nothing, but an allocation in the middle of it must not start another
+	static bool reclaiming;
+
+	if (reclaiming)
+		return false;
+
+	int mask = disable();
+	reclaiming = true;
+
+	bool freed = false;
+	for (int visited = 0; visited <= 2 * NPROC && !freed; visited++)
+	{
+		struct proc *p = proctab[hand_pid];
+
+		// kernel processes have no user pages, and neither does a process on its way out.
+		// a process running on another cpu can't have pages taken out from under it
+		if (p && p->pdir && !proc_running_elsewhere(p))
+			freed = scan(p);
+
+		if (!freed)
+		{
+			hand_pid = (hand_pid + 1) % NPROC;
+			hand_addr = 0;
+		}
+	}
+
+	reclaiming = false;
+	restore(mask);
+	return freed;
+}
+
+/**
+ * @brief moves the clock hand through the rest of a process's user address space
+ * @param p process the hand is on
+ * @return true if a block was freed, with the hand left just past the page it held
+ */
+static bool scan(struct proc *p)
+{
+	u32 *pdir = phys_to_virt(p->pdir);
+
+	for (; hand_addr < KERNEL_BASE; hand_addr += PAGE_SIZE)
+	{
+		u32 pde = pdir[hand_addr >> 22];
+
+		// 4M pages are never swapped, a single one would take a thousand slots
+		if (!(pde & PT_PRESENT) || (pde & PT_LARGE))
+		{
+			hand_addr = (hand_addr & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE - PAGE_SIZE;
+			continue;
+		}
+
+		u32 *pte = (u32 *) phys_to_virt(pde & PT_FRAME) + (hand_addr >> 12) % NUM_TABLE_ENTRIES;
+		if ((*pte & (PT_PRESENT | PT_USER)) != (PT_PRESENT | PT_USER))
+			continue;
+
+		// a shared frame would need every pte mapping it found and rewritten,
+		// and file pages belong to the page cache, pcache_shrink drops those once nothing maps them
+		struct page *pg = pmm_page(*pte & PT_FRAME);
+		if (pg->refs != 1 || (pg->flags & (PG_LOCKED | PG_PCACHE | PG_PAGETABLE)))
+			continue;
+
+		// vmm_scan_usage moves the accessed bit over to the page
+		if ((*pte & PT_ACCESSED) || (pg->flags & PG_REFERENCED))
+		{
+			// other address spaces lose their tlb entries when they are switched to
+			*pte &= ~PT_ACCESSED;
+			pg->flags &= ~PG_REFERENCED;
+			if (p == curr)
+				invlpg(hand_addr);
+
+			continue;
+		}
+
+		if (evict(p, hand_addr, pte))
+		{
+			hand_addr += PAGE_SIZE;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief moves a page out to zram or the disk
+ *
+ * zram is tried first, it costs a compression instead of a trip to the disk.
+ * pages it turns down, and pages that already have an up to date copy on disk, go to the disk.
+ *
+ * @param p process the page belongs to
+ * @param addr user address of the page
+ * @param pte the page's pte, reached through the direct map
+ * @return true if the page's block was freed
+ */
+static bool evict(struct proc *p, uintptr_t addr, u32 *pte)
+{
+	uintptr_t frame = *pte & PT_FRAME;
+	struct page *pg = pmm_page(frame);
+	u32 entry;
+
+	// read back from disk and not written since, the copy there is still good
+	// and the frame's reference to the slot passes to the pte
+	if ((pg->flags & PG_SWAPCACHE) && !(*pte & PT_DIRTY))
+	{
+		entry = pg->swap_entry;
+		pg->flags &= ~PG_SWAPCACHE;
+	}
+
+	else
+	{
+		if (pg->flags & PG_SWAPCACHE)
+		{
+			pg->flags &= ~PG_SWAPCACHE;
+			swap_free(pg->swap_entry);
+		}
+
+		// zram takes the frame over whether or not it frees it
+		bool freed;
+		u32 idx = zram_store(frame, !slot_refs, &freed);
+		if (idx)
+		{
+			*pte = idx << 12 | PT_ZRAM | PT_SWAP;
+			if (p == curr)
+				invlpg(addr);
+
+			return freed;
+		}
+
+		int slot = slot_alloc();
+		if (slot < 0)
+			return false;
+
+		slot_io(slot, phys_to_virt(frame), true);
+		entry = (u32) slot << 12 | PT_SWAP;
+	}
+
+	*pte = entry;
+	if (p == curr)
+		invlpg(addr);
+
+	pmm_unref(frame);
+	return true;
+}
+
+/**
+ * @brief reads a page of the current process back in from swap
+ *
+ * after a read the frame keeps its reference to the slot as long as nobody else needs it,
+ * so if the page is evicted again before being written it doesn't have to be written out.
+ *
+ * @param addr faulting user address
+ * @param write whether the faulting access was a write
+ * @return true if addr was in swap and is now mapped
+ */
+bool swap_in(uintptr_t addr, bool write)
+{
+	u32 *pte = vmm_get_pte(addr);
+	if (!pte || !(*pte & PT_SWAP))
+		return false;
+
+	struct vma *vma = vma_find(curr->vmas, addr);
+	if (!vma || (write && !(vma->flags & VMA_WRITE)))
+		return false;
+
+	// may evict other pages, but never this one's slot or page table
+	uintptr_t frame = pmm_alloc();
+	if (!frame)
+		return false;
+
+	int mask = disable();
+
+	u32 entry = *pte;
+	u32 slot = SWAP_SLOT(entry);
+
+	if (entry & PT_ZRAM)
+	{
+		if (!zram_load(slot, frame))
+		{
+			restore(mask);
+			pmm_free(frame, 0);
+			return false;
+		}
+	}
+
+	else
+	{
+		slot_io(slot, phys_to_virt(frame), false);
+	}
+
+	struct page *pg = pmm_page(frame);
+	pg->owner = curr;
+	curr->swapins++;
+
+	// zram copies are let go right away, keeping them would only waste the memory they save
+	if (!write && !(entry & PT_ZRAM) && slot_refs[slot] == 1)
+	{
+		pg->flags |= PG_SWAPCACHE;
+		pg->swap_entry = entry;
+	}
+
+	else
+	{
+		swap_free(entry);
+	}
+
+	unsigned flags = PT_PRESENT | PT_USER;
+	if (vma->flags & VMA_WRITE)
+		flags |= PT_WRITABLE;
+
+	*pte = frame | flags;
+	invlpg(addr & ~(PAGE_SIZE - 1));
+
+	restore(mask);
+	return true;
+}
+
+/**
+ * @brief takes another reference to a swapped out page, for a pte copied by fork
+ * @param entry the PT_SWAP pte
+ */
+void swap_dup(u32 entry)
+{
+	if (entry & PT_ZRAM)
+	{
+		zram_dup(SWAP_SLOT(entry));
+		return;
+	}
+
+	int mask = disable();
+	slot_refs[SWAP_SLOT(entry)]++;
+	restore(mask);
+}
+
+/**
+ * @brief drops a reference to a swapped out page, freeing its slot when the last one goes away
+ * @param entry the PT_SWAP pte
+ */
+void swap_free(u32 entry)
+{
+	u32 slot = SWAP_SLOT(entry);
+
+	if (entry & PT_ZRAM)
+	{
+		zram_free(slot);
+		return;
+	}
+
+	int mask = disable();
+
+	if (--slot_refs[slot] == 0)
+	{
+		nfree++;
+		if (slot < slot_hint)
+			slot_hint = slot;
+	}
+
+	restore(mask);
+}
@@ -24,13 +24,19 @@
 #include <intr.h>
 #include <kmalloc.h>
 #include <kprintf.h>
+#include <kprof.h>
+#include <memstat.h>
+#include <mman.h>
 #include <pmm.h>
 #include <proc.h>
+#include <slab.h>
 #include <vfs.h>
+#include <vma.h>
 #include <vmm.h>
 
+#include <string.h>
+
 // defined in proc.c
-extern struct proc *curr;
 extern struct proc *proctab[];
 
 extern void enter_usermode(void *, void *);
@@ -108,14 +114,19 @@ static void sys_sbrk(struct registers *regs)
 	void *sbrk = curr->sbrk;
 
 	kassert((increment % PAGE_SIZE) == 0, "sbrk: increment is not a multiple of PAGE_SIZE");
-	unsigned num_pages = increment / PAGE_SIZE;
-	for (unsigned i = 0; i < num_pages; i++)
+
+	// the heap only grows, and never into the stack area
+	uintptr_t brk = (uintptr_t) sbrk + increment;
+	if (increment < 0 || brk > KERNEL_BASE - USTACK_SIZE || vma_overlap(curr->vmas, (uintptr_t) sbrk, brk))
 	{
-		uintptr_t phys = pmm_alloc();
-		vmm_map_page(phys, (uintptr_t) curr->sbrk, PT_PRESENT | PT_WRITABLE | PT_USER);
-		curr->sbrk += PAGE_SIZE;
+		regs->eax = -1;
+		return;
 	}
 
+	// nothing is allocated until the new pages are touched
+	vma_map(&curr->vmas, (uintptr_t) sbrk, brk, VMA_WRITE, 0, 0, 0);
+	curr->sbrk = (void *) brk;
+
 	regs->eax = (u32) sbrk;
 }
 
@@ -193,62 +204,55 @@ static void sys_execv(struct registers *regs)
 		return;
 	}
 
-	int inode = curr->ofile[fd]->n->inode;
-	size_t s = ext2_filesize(inode);
-	u8 *buff = kmalloc(s);
-	ext2_read_data(buff, inode, 0, s);
-
-	struct elf_ehdr *ehdr = (struct elf_ehdr *) buff;
+	u32 inode = curr->ofile[fd]->n->inode;
+	vfs_close(fd);
 
 	// Create new address space
 	uintptr_t user_pdir = vmm_create_address_space();
 	if (!user_pdir)
 	{
-		kfree(buff);
 		for (int i = 0; i < argc; i++)
 			kfree(kargv[i]);
 		regs->eax = -1;
 		return;
 	}
 
-	// Update process state
+	// Lay out the new program's areas, its pages are brought in as they are touched
+	uintptr_t old_pdir = curr->pdir;
+	struct vma *old_vmas = curr->vmas;
 	curr->pdir = user_pdir;
-	for (i = 0; i < sizeof(curr->name) - 1 && kpath[i] != '\0'; i++)
-		curr->name[i] = kpath[i];
-	curr->name[i] = '\0';
-	curr->sbrk = NULL;    // Reset heap
+	curr->vmas = NULL;
 
-	// Map ELF program segments
-	struct elf_phdr *phdr_table = (struct elf_phdr *) (buff + ehdr->e_phoff);
-	for (uint i = 0; i < ehdr->e_phnum; i++)
+	uintptr_t entry = elf_load(curr, inode);
+	if (!entry)
 	{
-		struct elf_phdr *phdr = &phdr_table[i];
-		for (unsigned j = 0; j <= phdr->p_memsz / PAGE_SIZE; j++)
-		{
-			uintptr_t phys = pmm_alloc();
-			vmm_map_page_in_pdir(curr->pdir, phys, phdr->p_vaddr + j * PAGE_SIZE, PT_PRESENT | PT_WRITABLE | PT_USER);
-		}
+		// back on the old address space before the new one goes, the usage scan walks curr->pdir
+		vma_free(&curr->vmas);
+		curr->pdir = old_pdir;
+		curr->vmas = old_vmas;
+		vmm_destroy_address_space(user_pdir);
+		for (int i = 0; i < argc; i++)
+			kfree(kargv[i]);
+		regs->eax = -1;
+		return;
 	}
 
-	// Switch to the new address space
-	asm("mov %0, %%cr3" ::"r"(curr->pdir) : "memory");
+	// shared file mappings of the old image still have to reach the disk
+	vma_sync(old_vmas, 0, KERNEL_BASE);
+	vma_free(&old_vmas);
 
-	// Copy ELF segments into user space
-	for (uint i = 0; i < ehdr->e_phnum; i++)
-	{
-		struct elf_phdr *phdr = &phdr_table[i];
-		char *dst = (char *) phdr->p_vaddr;
-		char *src = (char *) &buff[phdr->p_offset];
-		for (size_t j = 0; j < phdr->p_memsz; j++)
-			dst[j] = src[j];
-	}
+	// Update process state
+	for (i = 0; i < sizeof(curr->name) - 1 && kpath[i] != '\0'; i++)
+		curr->name[i] = kpath[i];
+	curr->name[i] = '\0';
 
-	kfree(buff);
+	// Switch to the new address space, then the old one can go
+	asm("mov %0, %%cr3" ::"r"(curr->pdir) : "memory");
+	if (old_pdir)
+		vmm_destroy_address_space(old_pdir);
 
-	// Set up environment page for argv
+	// Environment page for argv is the top page of the stack area
 	void *env = (void *) (0xc0000000 - PR_STACKSIZE);
-	uintptr_t env_phys = pmm_alloc();
-	vmm_map_page_in_pdir(curr->pdir, env_phys, (uintptr_t) env, PT_PRESENT | PT_WRITABLE | PT_USER);
 
 	// Copy argv strings to environment page
 	char **envp = (char **) env;
@@ -275,9 +279,7 @@ static void sys_execv(struct registers *regs)
 	}
 	envp[argc] = NULL;
 
-	// Create user stack
-	uintptr_t ustack_phys = pmm_alloc();
-	vmm_map_page_in_pdir(curr->pdir, ustack_phys, 0xc0000000 - 2 * PR_STACKSIZE, PT_PRESENT | PT_WRITABLE | PT_USER);
+	// User stack starts right below the environment page
 	u32 *ustack = (u32 *) (0xc0000000 - PR_STACKSIZE);
 
 	// Push argc and argv onto stack
@@ -287,7 +289,7 @@ static void sys_execv(struct registers *regs)
 	*ustack = argc;
 
 	// Jump to new program entry point (does not return)
-	enter_usermode(ustack, (void *) ehdr->e_entry);
+	enter_usermode(ustack, (void *) entry);
 }
 
 /**
@@ -358,7 +360,7 @@ static void sys_waitpid(struct registers *regs)
 	int *status = (int *) regs->ecx;
 	int options = (int) regs->edx;
 
-	struct proc *child = proctab[pid];
+	struct proc *child = pid >= 0 && pid < NPROC ? proctab[pid] : NULL;
 	if (child == NULL || child->parent != curr->pid)
 	{
 		kprintf("waitpid: no such child process %d\n", pid);
@@ -366,19 +368,19 @@ static void sys_waitpid(struct registers *regs)
 		return;
 	}
 
-	// If child is already terminated, return immediately
-	if (child->state == PR_TERMINATED)
+	// Sleep until the child terminates, proc_exit readies us again
+	while (child->state != PR_TERMINATED)
 	{
-		if (status)
-			*status = 0;    // TODO - set actual exit status
-		regs->eax = pid;
-		return;
+		curr->state = PR_WAITING;
+		curr->waiting_for = pid;
+		sched();
 	}
 
-	// Otherwise, put current process to sleep until child terminates
-	curr->state = PR_WAITING;
-	curr->waiting_for = pid;
-	sched();
+	if (status)
+		*status = child->exit_status;
+
+	proc_reap(child);
+	regs->eax = pid;
 }
 
 static void sys_ioctl(struct registers *regs)
@@ -411,8 +413,226 @@ static void sys_ioctl(struct registers *regs)
 	}
 }
 
-void (*syscall_handlers[])(struct registers *) = { sys_read,  sys_write,    sys_exit,    sys_open,
-	                                               sys_sbrk,  sys_getdents, sys_fork,    sys_execv,
-	                                               sys_close, sys_getenv,   sys_waitpid, sys_ioctl };
+/**
+ * @brief syscall 12 - mmap
+ * @param args ebx, pointer to a struct mmap_args
+ * @return address of the new mapping, or -1 on error
+ */
+static void sys_mmap(struct registers *regs)
+{
+	struct mmap_args *args = (struct mmap_args *) regs->ebx;
+	size_t len = BLOCK_ALIGN(args->len);
+	int flags = args->flags;
+	bool anonymous = flags & MAP_ANONYMOUS;
+
+	// large pages are only a hint, without pse the mapping just uses 4K pages
+	bool large = anonymous && (flags & MAP_LARGE) && vmm_has_large_pages();
+	size_t align = large ? LARGE_PAGE_SIZE : PAGE_SIZE;
+	if (large)
+		len = (args->len + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+
+	regs->eax = -1;
+
+	// exactly one of MAP_SHARED and MAP_PRIVATE
+	if (len == 0 || len > KERNEL_BASE || !(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+		return;
+
+	// anonymous memory has no file to share it through, fork would quietly give the child a copy
+	if (anonymous && (flags & MAP_SHARED))
+		return;
+
+	u32 inode = 0;
+	if (!anonymous)
+	{
+		if (args->fd < 0 || args->fd >= NOFILE || !curr->ofile[args->fd] || args->off % PAGE_SIZE)
+			return;
+
+		inode = curr->ofile[args->fd]->n->inode;
+	}
+
+	uintptr_t start;
+	if (flags & MAP_FIXED)
+	{
+		start = (uintptr_t) args->addr;
+		if (start % align || start == 0 || start + len > KERNEL_BASE - USTACK_SIZE || start + len < start)
+			return;
+
+		if (vma_splits_large(curr->vmas, start, start + len))
+			return;
+
+		vma_unmap(&curr->vmas, start, start + len);
+	}
+
+	else
+	{
+		// take the highest hole below the stack, the heap grows up towards it
+		uintptr_t end = (KERNEL_BASE - USTACK_SIZE) & ~(align - 1);
+		struct vma *vma;
+		while (end >= len && (vma = vma_overlap(curr->vmas, end - len, end)))
+			end = vma->start & ~(align - 1);
+
+		if (end < len || end - len < (uintptr_t) curr->sbrk)
+			return;
+
+		start = end - len;
+	}
+
+	unsigned vflags = 0;
+	if (args->prot & PROT_WRITE)
+		vflags |= VMA_WRITE;
+
+	if (flags & MAP_SHARED)
+		vflags |= VMA_SHARED;
+
+	if (large)
+		vflags |= VMA_LARGE;
+
+	// the page cache zero fills past the end of the file, so the whole mapping counts as file backed
+	vma_map(&curr->vmas, start, start + len, vflags, inode, anonymous ? 0 : args->off, anonymous ? 0 : len);
+	regs->eax = start;
+}
+
+/**
+ * @brief syscall 13 - munmap
+ * @param addr ebx
+ * @param len ecx
+ * @return 0 on success, -1 on error
+ */
+static void sys_munmap(struct registers *regs)
+{
+	uintptr_t addr = regs->ebx;
+	size_t len = BLOCK_ALIGN(regs->ecx);
+
+	if (addr % PAGE_SIZE || addr + len > KERNEL_BASE || addr + len < addr || vma_splits_large(curr->vmas, addr, addr + len))
+	{
+		regs->eax = -1;
+		return;
+	}
+
+	vma_unmap(&curr->vmas, addr, addr + len);
+	regs->eax = 0;
+}
+
+/**
+ * @brief syscall 14 - msync
+ * @param addr ebx
+ * @param len ecx
+ * @param flags edx
+ * @return 0 on success, -1 on error
+ *
+ * writes go to disk before returning, so MS_ASYNC behaves like MS_SYNC.
+ * mappings already share the page cache, so MS_INVALIDATE has nothing to do.
+ */
+static void sys_msync(struct registers *regs)
+{
+	uintptr_t addr = regs->ebx;
+	size_t len = BLOCK_ALIGN(regs->ecx);
+
+	if (addr % PAGE_SIZE || addr + len > KERNEL_BASE || addr + len < addr)
+	{
+		regs->eax = -1;
+		return;
+	}
+
+	vma_sync(curr->vmas, addr, addr + len);
+	regs->eax = 0;
+}
+
+/**
+ * @brief syscall 15 - kprof
+ * prints the slab caches and the kernel allocation profile to the serial console,
+ * see print_slabinfo and kprof_dump
+ * @return 0, or -1 if the kernel wasn't built with KMALLOC_PROFILE (the caches are printed either way)
+ */
+static void sys_kprof(struct registers *regs)
+{
+	print_slabinfo();
+	regs->eax = kprof_dump();
+}
+
+/**
+ * @brief syscall 16 - memstat
+ * @param pid ebx
+ * @param buf ecx, pointer to a struct memstat to fill in
+ * @return 0, MEMSTAT_NOPROC if there is no process pid, or MEMSTAT_END if pid is past the end of the process table
+ */
+static void sys_memstat(struct registers *regs)
+{
+	int pid = (int) regs->ebx;
+	struct memstat *buf = (struct memstat *) regs->ecx;
+
+	// lets ps walk every pid without knowing how big the table is
+	if (pid >= NPROC)
+	{
+		regs->eax = MEMSTAT_END;
+		return;
+	}
+
+	struct proc *p = pid >= 0 ? proctab[pid] : NULL;
+	if (!p || !buf)
+	{
+		regs->eax = MEMSTAT_NOPROC;
+		return;
+	}
+
+	buf->pid     = p->pid;
+	buf->parent  = p->parent;
+	buf->state   = p->state;
+	strncpy(buf->name, p->name, sizeof(buf->name));
+	buf->rss     = p->rss;
+	buf->dirty   = p->dirty;
+	buf->wss     = p->wss;
+	buf->faults  = p->faults;
+	buf->swapins = p->swapins;
+
+	regs->eax = 0;
+}
+
+/**
+ * @brief syscall 17 - nice
+ * moves the base scheduling level of the current process, higher is less important
+ * @param inc ebx, amount to add to the base level
+ * @return the new base level, clamped to the levels there are
+ */
+static void sys_nice(struct registers *regs)
+{
+	int nice = curr->nice + (int) regs->ebx;
+
+	if (nice < 0)
+		nice = 0;
+
+	if (nice > NPRIO - 1)
+		nice = NPRIO - 1;
+
+	int mask = disable();
+	curr->nice = nice;
+
+	// the process can't be any more important than its base level
+	if (curr->prio < nice)
+	{
+		curr->prio = nice;
+		curr->slice = sched_quantum(nice);
+	}
+
+	restore(mask);
+	regs->eax = nice;
+}
+
+/**
+ * @brief syscall 18 - sched_yield
+ * gives the cpu to the next process on the same level, if there is one
+ * @return 0
+ */
+static void sys_sched_yield(struct registers *regs)
+{
+	sched();
+	regs->eax = 0;
+}
+
+void (*syscall_handlers[])(struct registers *) = { sys_read,    sys_write,    sys_exit,    sys_open,
+	                                               sys_sbrk,    sys_getdents, sys_fork,    sys_execv,
+	                                               sys_close,   sys_getenv,   sys_waitpid, sys_ioctl,
+	                                               sys_mmap,    sys_munmap,   sys_msync,   sys_kprof,
+	                                               sys_memstat, sys_nice,     sys_sched_yield };
 
 const int NUM_SYSCALLS = sizeof(syscall_handlers) / sizeof(syscall_handlers[0]);
@@ -0,0 +1,274 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: timer.c
+ * DATE: October 18th, 2026
+ * DESCRIPTION: kernel timers on a hierarchical timing wheel
+ *
+ * The near wheel has a slot for each of the next NEAR_SLOTS ms. Timers further out go on
+ * one of the far wheels, each FAR_SLOTS times coarser than the one before it, and the four
+ * of them together reach across all 32 bits of the uptime. Every time the near wheel comes
+ * back around to slot 0 the next slot of the first far wheel is emptied back into the
+ * wheels, which puts its timers on the near wheel, and each far wheel that comes back around
+ * does the same to the one past it. A timer is moved down at most once per level.
+ */
+#include <timer.h>
+
+#include <clk.h>
+#include <intr.h>
+#include <kprintf.h>
+
+#define NEAR_BITS  8
+#define NEAR_SLOTS (1 << NEAR_BITS)
+#define NEAR_MASK  (NEAR_SLOTS - 1)
+
+#define FAR_BITS   6
+#define FAR_SLOTS  (1 << FAR_BITS)
+#define FAR_MASK   (FAR_SLOTS - 1)
+#define FAR_LEVELS 4
+
+// deadlines are compared as signed differences, so they can't be further out than this
+#define MAX_DELAY 0x7fffffff
+
+static struct list_head near[NEAR_SLOTS];
+static struct list_head far[FAR_LEVELS][FAR_SLOTS];
+
+// next ms the wheel will run the timers of
+static u32 wheel_time;
+
+void timer_init()
+{
+	for (int i = 0; i < NEAR_SLOTS; i++)
+		list_init(&near[i]);
+
+	for (int level = 0; level < FAR_LEVELS; level++)
+	{
+		for (int i = 0; i < FAR_SLOTS; i++)
+			list_init(&far[level][i]);
+	}
+
+	wheel_time = uptime();
+}
+
+/**
+ * @brief puts a timer in the slot its deadline falls in, relative to where the wheel is now
+ * a timer that is already due goes in the next slot to run
+ */
+static void enqueue(struct timer *t)
+{
+	u32 delta = t->expires - wheel_time;
+	struct list_head *slot;
+
+	if ((s32) delta < 0)
+	{
+		slot = &near[wheel_time & NEAR_MASK];
+	}
+
+	else if (delta < NEAR_SLOTS)
+	{
+		slot = &near[t->expires & NEAR_MASK];
+	}
+
+	else
+	{
+		int level = 0;
+		while (level < FAR_LEVELS - 1 && delta >= 1u << (NEAR_BITS + (level + 1) * FAR_BITS))
+			level++;
+
+		slot = &far[level][(t->expires >> (NEAR_BITS + level * FAR_BITS)) & FAR_MASK];
+	}
+
+	list_append(slot, &t->link);
+}
+
+/**
+ * @brief empties a slot of a far wheel back into the wheels, moving its timers closer in
+ * @param level far wheel
+ * @param idx slot of the wheel
+ * @return idx, when it is 0 the wheel has come around and the next one out has to be emptied too
+ */
+static int cascade(int level, int idx)
+{
+	struct list_head moving;
+	list_init(&moving);
+
+	// timers can land back in this same slot, so take them all off before putting any back
+	struct list_head *node;
+	while ((node = list_pop_front(&far[level][idx])))
+		list_append(&moving, node);
+
+	while ((node = list_pop_front(&moving)))
+		enqueue(list_entry(node, struct timer, link));
+
+	return idx;
+}
+
+/**
+ * @brief prepares a timer, it isn't pending until it is added
+ * @param t timer to set up
+ * @param fn function to call when the timer goes off
+ * @param arg argument to pass to fn
+ */
+void timer_setup(struct timer *t, void (*fn)(void *), void *arg)
+{
+	list_init(&t->link);
+	t->expires = 0;
+	t->period  = 0;
+	t->fn      = fn;
+	t->arg     = arg;
+}
+
+/**
+ * @brief checks whether a timer has been added and hasn't gone off or been cancelled since
+ */
+bool timer_pending(struct timer *t)
+{
+	return !list_empty(&t->link);
+}
+
+/**
+ * @brief starts a timer that goes off once, a timer that is already pending is moved
+ * @param t timer to start
+ * @param delay ms from now until the timer goes off
+ */
+void timer_add(struct timer *t, u32 delay)
+{
+	if (delay > MAX_DELAY)
+		delay = MAX_DELAY;
+
+	int mask = disable();
+
+	if (timer_pending(t))
+		list_unlink(&t->link);
+
+	t->expires = uptime() + delay;
+	t->period  = 0;
+	enqueue(t);
+	clk_wake_by(t->expires);
+
+	restore(mask);
+}
+
+/**
+ * @brief starts a timer that goes off every period ms until it is cancelled
+ * @param t timer to start
+ * @param period ms between expiries
+ */
+void timer_add_periodic(struct timer *t, u32 period)
+{
+	if (period == 0 || period > MAX_DELAY)
+	{
+		kprintf("timer_add_periodic: bad period %d\n", period);
+		return;
+	}
+
+	int mask = disable();
+
+	if (timer_pending(t))
+		list_unlink(&t->link);
+
+	t->expires = uptime() + period;
+	t->period  = period;
+	enqueue(t);
+	clk_wake_by(t->expires);
+
+	restore(mask);
+}
+
+/**
+ * @brief stops a timer, a periodic timer can be cancelled from its own function
+ * @param t timer to stop
+ * @return true if the timer was pending
+ */
+bool timer_cancel(struct timer *t)
+{
+	int mask = disable();
+
+	bool pending = timer_pending(t);
+	if (pending)
+		list_unlink(&t->link);
+
+	t->period = 0;
+
+	restore(mask);
+	return pending;
+}
+
+/**
+ * @brief runs every timer that is due, called by the clock interrupt
+ *
+ * the wheel is brought up to now a slot at a time, so every timer due at the same ms goes
+ * off together and none is left for a later tick. timer functions run with interrupts off
+ * and must not block, they may add and cancel timers, their own included.
+ *
+ * @param now current uptime in ms
+ */
+void timer_tick(u32 now)
+{
+	int mask = disable();
+
+	while ((s32) (now - wheel_time) >= 0)
+	{
+		int idx = wheel_time & NEAR_MASK;
+
+		for (int level = 0; idx == 0 && level < FAR_LEVELS; level++)
+		{
+			if (cascade(level, (wheel_time >> (NEAR_BITS + level * FAR_BITS)) & FAR_MASK) != 0)
+				break;
+		}
+
+		struct list_head due;
+		list_init(&due);
+
+		struct list_head *node;
+		while ((node = list_pop_front(&near[idx])))
+			list_append(&due, node);
+
+		// anything added from here on belongs to a later slot, or to the next one if it is already due
+		wheel_time++;
+
+		while ((node = list_pop_front(&due)))
+		{
+			struct timer *t = list_entry(node, struct timer, link);
+
+			// a periodic timer running behind goes off once for every period it missed
+			if (t->period)
+			{
+				t->expires += t->period;
+				enqueue(t);
+			}
+
+			t->fn(t->arg);
+		}
+	}
+
+	restore(mask);
+}
+
+/**
+ * @brief finds when the wheel next has to run, for programming the clock
+ *
+ * a timer on a far wheel goes off no sooner than the cascade that brings it onto the near
+ * wheel, so only the near wheel has to be looked at, up to the next time it wraps around.
+ *
+ * @param limit latest uptime the caller cares about
+ * @return uptime of the earliest slot with timers in it or cascade, or limit if there is nothing sooner
+ */
+u32 timer_next(u32 limit)
+{
+	int mask = disable();
+
+	u32 t = wheel_time;
+	while ((s32) (limit - t) > 0)
+	{
+		if ((t & NEAR_MASK) == 0 || !list_empty(&near[t & NEAR_MASK]))
+			break;
+
+		t++;
+	}
+
+	restore(mask);
+	return t;
+}
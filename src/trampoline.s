@@ -0,0 +1,96 @@
+; maestro
+; License: GPLv2
+; See LICENSE.txt for full license text
+; Author: Sam Kravitz
+;
+; FILE: trampoline.s
+; DATE: October 18th, 2026
+; DESCRIPTION: where the application processors start executing
+;
+; a cpu woken up by a startup ipi starts out in real mode, at the start of the page the
+; ipi names. smp_init copies this code to AP_TRAMPOLINE, fills in ap_trampoline_args and
+; sends the ipi. the code goes to protected mode with the same paging the boot cpu has and
+; calls the entry point with the cpu's struct cpu, on the stack of the cpu's null process.
+;
+; the code runs at AP_BASE instead of where it is linked, so every address in it is worked
+; out from its offset into the trampoline
+
+	global ap_trampoline
+	global ap_trampoline_args
+	global ap_trampoline_end
+
+AP_BASE equ 8000h          ; AP_TRAMPOLINE in smp.h, a startup ipi can only name a page below 1M
+
+; offsets into ap_trampoline_args, see struct ap_args in smp.c
+ARG_CR3   equ 0
+ARG_CR4   equ 4
+ARG_STACK equ 8
+ARG_ENTRY equ 12
+ARG_CPU   equ 16
+
+	section .text
+
+[bits 16]
+ap_trampoline:
+	cli
+	cld
+	xor ax, ax
+	mov ds, ax
+
+	lgdt [AP_BASE + (gdt_descriptor - ap_trampoline)]
+
+	mov eax, cr0
+	or eax, 1                      ; protected mode
+	mov cr0, eax
+
+	jmp dword 08h:(AP_BASE + (ap_protected - ap_trampoline))
+
+[bits 32]
+ap_protected:
+	mov ax, 10h
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+
+	mov ebx, AP_BASE + (ap_trampoline_args - ap_trampoline)
+
+	; pse and pge have to be on before paging, the kernel's page directory uses both
+	mov eax, [ebx + ARG_CR4]
+	mov cr4, eax
+	mov eax, [ebx + ARG_CR3]
+	mov cr3, eax
+
+	mov eax, cr0
+	or eax, 80010000h              ; paging, and write protection like vmm_init turns on
+	mov cr0, eax
+
+	; the trampoline is identity mapped in the kernel's page directory, so this carries on as before
+	mov esp, [ebx + ARG_STACK]
+	xor ebp, ebp
+	push dword [ebx + ARG_CPU]
+	call dword [ebx + ARG_ENTRY]
+
+	jmp $                          ; the entry point never returns
+
+; flat code and data segments, only used to get into the kernel.
+; the cpu loads its own gdt as soon as it gets there
+gdt:
+	dq 0
+	dq 00cf9a000000ffffh           ; kernel code
+	dq 00cf92000000ffffh           ; kernel data
+gdt_end:
+
+gdt_descriptor:
+	dw gdt_end - gdt - 1
+	dd AP_BASE + (gdt - ap_trampoline)
+
+; filled in by smp_init for every cpu it starts
+ap_trampoline_args:
+	dd 0                           ; cr3
+	dd 0                           ; cr4
+	dd 0                           ; stack
+	dd 0                           ; entry point
+	dd 0                           ; struct cpu
+ap_trampoline_end:
@@ -12,22 +12,25 @@
 #include <ext2.h>
 #include <kmalloc.h>
 #include <kprintf.h>
+#include <pcache.h>
 #include <proc.h>
+#include <slab.h>
 #include <tty.h>
-#include <kmalloc.h>
 
 #include <stdio.h>
 #include <string.h>
 
 static struct vnode *root = NULL;
 
+static struct kmem_cache *vnode_cache;
+static struct kmem_cache *file_cache;
+
 static void build_tree(struct vnode *);
 static struct vnode *find(char *);
 static struct vnode *find_parent(char *);
 static struct vnode *find_helper(const struct vnode *, char *);
 static void print_tree(struct vnode *, int);
 
-extern struct proc *curr;
 
 static inline bool is_open(int fd)
 {
@@ -55,8 +58,11 @@ static inline void insert_child(struct vnode *parent, struct vnode *child)
  */
 void vfs_init()
 {
+	vnode_cache = kmem_cache_create("vnode", sizeof(struct vnode), NULL);
+	file_cache = kmem_cache_create("file", sizeof(struct file), NULL);
+
 	// allocate root node
-	root = (struct vnode *) kmalloc(sizeof(struct vnode));
+	root = kmem_cache_alloc(vnode_cache);
 	root->inode = ROOT_INODE;
 	root->type = DIR_TYPE_DIR;
 	root->num_children = 0;
@@ -98,7 +104,7 @@ struct vnode *vfs_mkdir(char *path)
 	}
 
 	// allocate memory for the new directory in the tree
-	struct vnode *node = (struct vnode *) kmalloc(sizeof(struct vnode));
+	struct vnode *node = kmem_cache_alloc(vnode_cache);
 	node->inode = inode;
 	node->type = DIR_TYPE_DIR;
 	node->num_children = 0;
@@ -142,7 +148,7 @@ struct vnode *vfs_touch(char *path)
 	}
 
 	// allocate memory for the new file in the tree
-	struct vnode *node = (struct vnode *) kmalloc(sizeof(struct vnode));
+	struct vnode *node = kmem_cache_alloc(vnode_cache);
 	node->inode = inode;
 	node->type = DIR_TYPE_REG;
 	node->num_children = 0;
@@ -154,6 +160,16 @@ struct vnode *vfs_touch(char *path)
 	return node;
 }
 
+/**
+ * @brief finds the vnode of a path, for kernel code that works on files without opening them
+ * @param path absolute path of the file to find
+ * @return the file's vnode or NULL if it doesn't exist
+ */
+struct vnode *vfs_lookup(char *path)
+{
+	return find(path);
+}
+
 /**
  * @brief opens a file in the context of the running process
  * @param path absolute path of the file to open
@@ -189,11 +205,12 @@ int vfs_open(char *path)
 		return -1;
 	}
 
-	struct file *f = kmalloc(sizeof(struct file));
+	struct file *f = kmem_cache_alloc(file_cache);
 
 	f->size = ext2_filesize(node->inode);
 	f->pos = 0;
 	f->n = node;
+	f->refs = 1;
 
 	curr->ofile[fd] = f;
 	return fd;
@@ -207,7 +224,10 @@ int vfs_close(int fd)
 		return -1;
 	}
 
-	kfree(curr->ofile[fd]);
+	// a forked process may still be using it
+	if (--curr->ofile[fd]->refs == 0)
+		kmem_cache_free(file_cache, curr->ofile[fd]);
+
 	curr->ofile[fd] = NULL;
 	return 0;
 }
@@ -280,11 +300,14 @@ int vfs_write(int fd, void *buff, size_t count)
 
 	// TODO - delegate ext2 specific work to a generic fs driver to keep
 	// vfs isolated from ext2, in case support for other filesystems is added
-	ext2_write_data(buff, f->n->inode, f->pos, count);
+	int written = ext2_write_data(buff, f->n->inode, f->pos, count);
 
-	f->pos += count;
+	// mappings of the file see the new data through the page cache
+	pcache_update(f->n->inode, f->pos, buff, written);
 
-	return 0;
+	f->pos += written;
+
+	return written;
 }
 
 /**
@@ -432,7 +455,7 @@ static void build_tree(struct vnode *node)
 	while (bytes_read < EXT2_BLOCK_SIZE)
 	{
 		// allocate memory for this node
-		struct vnode *child = (struct vnode *) kmalloc(sizeof(struct vnode));
+		struct vnode *child = kmem_cache_alloc(vnode_cache);
 		child->inode = entry->inode;
 		child->type = entry->type;
 		child->num_children = 0;
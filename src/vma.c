@@ -0,0 +1,287 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: vma.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: virtual memory areas of a process
+ */
+#include <vma.h>
+
+#include <ext2.h>
+#include <kmalloc.h>
+#include <pmm.h>
+#include <swap.h>
+#include <vmm.h>
+
+/**
+ * @brief adds an area to a process's list of areas
+ *
+ * an anonymous area that starts right where an existing anonymous area with the
+ * same flags ends just extends it, so growing the heap one page at a time
+ * doesn't grow the list
+ *
+ * @param list list of areas to add to
+ * @param start first address of the area
+ * @param end address one past the end of the area
+ * @param flags VMA_* flags
+ * @param inode inode backing the area, or 0 for anonymous memory
+ * @param off offset in the file that start maps to
+ * @param filesz number of bytes of the area backed by the file
+ * @return the area covering [start, end)
+ */
+struct vma *vma_map(struct vma **list, uintptr_t start, uintptr_t end, unsigned flags, u32 inode, size_t off, size_t filesz)
+{
+	if (inode == 0)
+	{
+		for (struct vma *vma = *list; vma; vma = vma->next)
+		{
+			if (vma->inode == 0 && vma->flags == flags && vma->end == start)
+			{
+				vma->end = end;
+				return vma;
+			}
+		}
+	}
+
+	struct vma *vma = kmalloc(sizeof(struct vma));
+	vma->start  = start;
+	vma->end    = end;
+	vma->flags  = flags;
+	vma->inode  = inode;
+	vma->off    = off;
+	vma->filesz = filesz;
+	vma->next   = *list;
+
+	*list = vma;
+	return vma;
+}
+
+/**
+ * @brief finds the area containing an address
+ * @param list list of areas to search
+ * @param addr address to look up
+ * @return the area containing addr or NULL if it isn't mapped
+ */
+struct vma *vma_find(struct vma *list, uintptr_t addr)
+{
+	for (struct vma *vma = list; vma; vma = vma->next)
+	{
+		if (addr >= vma->start && addr < vma->end)
+			return vma;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief copies a list of areas, used when forking
+ * @param list list of areas to copy
+ * @return the copy
+ */
+struct vma *vma_dup(struct vma *list)
+{
+	struct vma *copy = NULL;
+	struct vma **tail = &copy;
+
+	for (struct vma *vma = list; vma; vma = vma->next)
+	{
+		struct vma *dup = kmalloc(sizeof(struct vma));
+		*dup = *vma;
+		dup->next = NULL;
+
+		*tail = dup;
+		tail = &dup->next;
+	}
+
+	return copy;
+}
+
+/**
+ * @brief frees every area in a list
+ * @param list list of areas to free, set to NULL afterwards
+ */
+void vma_free(struct vma **list)
+{
+	struct vma *vma = *list;
+	while (vma)
+	{
+		struct vma *next = vma->next;
+		kfree(vma);
+		vma = next;
+	}
+
+	*list = NULL;
+}
+
+/**
+ * @brief finds an area overlapping a range of addresses
+ * @param list list of areas to search
+ * @param start first address of the range
+ * @param end address one past the end of the range
+ * @return an area overlapping [start, end) or NULL if the range is unused
+ */
+struct vma *vma_overlap(struct vma *list, uintptr_t start, uintptr_t end)
+{
+	for (struct vma *vma = list; vma; vma = vma->next)
+	{
+		if (vma->start < end && start < vma->end)
+			return vma;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief writes modified pages of shared file mappings back to their file
+ *
+ * only pages the cpu marked dirty in the current address space are written.
+ * the page cache frame is what is mapped, so the cache is already up to date.
+ *
+ * @param list list of areas of the current process
+ * @param start first address of the range to sync
+ * @param end address one past the end of the range
+ */
+void vma_sync(struct vma *list, uintptr_t start, uintptr_t end)
+{
+	for (struct vma *vma = list; vma; vma = vma->next)
+	{
+		if (!(vma->flags & VMA_SHARED) || !vma->inode)
+			continue;
+
+		uintptr_t first = vma->start > start ? vma->start : start;
+		uintptr_t last = vma->end < end ? vma->end : end;
+
+		for (uintptr_t page = first; page < last; page += PAGE_SIZE)
+		{
+			u32 *pte = vmm_get_pte(page);
+			if (!pte || (*pte & (PT_PRESENT | PT_DIRTY)) != (PT_PRESENT | PT_DIRTY))
+				continue;
+
+			ext2_write_data((void *) page, vma->inode, vma->off + (page - vma->start), PAGE_SIZE);
+			*pte &= ~PT_DIRTY;
+			invlpg(page);
+		}
+	}
+}
+
+/**
+ * @brief moves the start of an area forward, keeping the rest of it mapped to the same file bytes
+ */
+static void vma_advance(struct vma *vma, uintptr_t start)
+{
+	size_t d = start - vma->start;
+
+	vma->start = start;
+	vma->off += d;
+	vma->filesz = vma->filesz > d ? vma->filesz - d : 0;
+}
+
+/**
+ * @brief removes a range of addresses from the current process
+ *
+ * shared file pages are written back first, then every page in the range is
+ * unmapped and its frame or swap slot released. areas are trimmed, split, or freed to match.
+ *
+ * @param list list of areas of the current process
+ * @param start first address of the range (page aligned)
+ * @param end address one past the end of the range (page aligned)
+ */
+void vma_unmap(struct vma **list, uintptr_t start, uintptr_t end)
+{
+	vma_sync(*list, start, end);
+
+	for (uintptr_t page = start; page < end; page += PAGE_SIZE)
+	{
+		// callers never cut a 4M page in half, see vma_splits_large
+		u32 *pde = vmm_get_pde(page);
+		if ((*pde & PT_PRESENT) && (*pde & PT_LARGE))
+		{
+			pmm_unref(*pde & PT_FRAME);
+			*pde = 0;
+			invlpg(page);
+			page += LARGE_PAGE_SIZE - PAGE_SIZE;
+			continue;
+		}
+
+		u32 *pte = vmm_get_pte(page);
+		if (!pte || !(*pte & (PT_PRESENT | PT_SWAP)))
+			continue;
+
+		if (*pte & PT_PRESENT)
+			vmm_drop_page(*pte);
+		else
+			swap_free(*pte);
+
+		*pte = 0;
+		invlpg(page);
+	}
+
+	struct vma **link = list;
+	while (*link)
+	{
+		struct vma *vma = *link;
+		if (vma->end <= start || vma->start >= end)
+		{
+			link = &vma->next;
+			continue;
+		}
+
+		// parts of the area in front of and behind the range survive
+		bool head = vma->start < start;
+		bool tail = vma->end > end;
+
+		if (head && tail)
+		{
+			struct vma *rest = kmalloc(sizeof(struct vma));
+			*rest = *vma;
+			vma_advance(rest, end);
+			vma->end = start;
+			vma->next = rest;
+			link = &rest->next;
+		}
+
+		else if (head)
+		{
+			vma->end = start;
+			link = &vma->next;
+		}
+
+		else if (tail)
+		{
+			vma_advance(vma, end);
+			link = &vma->next;
+		}
+
+		else
+		{
+			*link = vma->next;
+			kfree(vma);
+		}
+	}
+}
+
+/**
+ * @brief checks whether unmapping a range would cut one of the 4M pages of a large area
+ * @param list list of areas of the current process
+ * @param start first address of the range
+ * @param end address one past the end of the range
+ * @return true if start or end lands inside a 4M page of a VMA_LARGE area
+ */
+bool vma_splits_large(struct vma *list, uintptr_t start, uintptr_t end)
+{
+	for (struct vma *vma = list; vma; vma = vma->next)
+	{
+		if (!(vma->flags & VMA_LARGE))
+			continue;
+
+		if (start > vma->start && start < vma->end && start % LARGE_PAGE_SIZE)
+			return true;
+
+		if (end > vma->start && end < vma->end && end % LARGE_PAGE_SIZE)
+			return true;
+	}
+
+	return false;
+}
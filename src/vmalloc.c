@@ -0,0 +1,206 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: vmalloc.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: virtually contiguous kernel allocations
+ */
+#include <vmalloc.h>
+
+#include <intr.h>
+#include <kmalloc.h>
+#include <kprintf.h>
+#include <kprof.h>
+#include <vmm.h>
+
+// a range of the vmalloc area in use
+struct varea
+{
+	uintptr_t start;       // first address of the allocation
+	size_t pages;          // number of mapped pages, the guard page after them isn't counted
+	struct varea *next;
+};
+
+// ranges in use, sorted by address
+static struct varea *areas;
+
+/**
+ * @brief takes the range starting at a given address off the list
+ * @return the range or NULL if no range starts there
+ */
+static struct varea *unlink_area(uintptr_t start)
+{
+	int mask = disable();
+
+	struct varea **link = &areas;
+	while (*link && (*link)->start != start)
+		link = &(*link)->next;
+
+	struct varea *area = *link;
+	if (area)
+		*link = area->next;
+
+	restore(mask);
+	return area;
+}
+
+/**
+ * @brief claims a free range of the vmalloc area, nothing is mapped in it yet
+ * @param pages number of pages the range needs, the guard page after them is added here
+ * @return the range, already on the list, or NULL if out of memory or address space
+ */
+static struct varea *claim(size_t pages)
+{
+	struct varea *area = kmalloc(sizeof(struct varea));
+	if (!area)
+		return NULL;
+
+	area->pages = pages;
+	size_t span = (area->pages + 1) * PAGE_SIZE;
+
+	int mask = disable();
+
+	// first fit, the gap in front of each range and then the space after the last one
+	uintptr_t start = VMALLOC_BASE;
+	struct varea **link = &areas;
+	while (*link && (*link)->start - start < span)
+	{
+		start = (*link)->start + ((*link)->pages + 1) * PAGE_SIZE;
+		link = &(*link)->next;
+	}
+
+	if (start + span > VMALLOC_END || start + span < start)
+	{
+		restore(mask);
+		kfree(area);
+		kprintf("vmalloc: out of address space for %d pages\n", pages);
+		return NULL;
+	}
+
+	// claim the range before mapping, so nothing else can take it in the meantime
+	area->start = start;
+	area->next  = *link;
+	*link = area;
+
+	restore(mask);
+	return area;
+}
+
+/**
+ * @brief allocates a virtually contiguous kernel buffer
+ * @param size size in bytes of the buffer
+ * @return page aligned pointer to the buffer, or NULL if out of memory or address space
+ */
+void *vmalloc(size_t size)
+{
+	if (size == 0)
+		return NULL;
+
+	struct varea *area = claim((size + PAGE_SIZE - 1) / PAGE_SIZE);
+	if (!area)
+		return NULL;
+
+	uintptr_t start = area->start;
+	if (vmm_map_kernel(start, area->pages) < 0)
+	{
+		kprintf("vmalloc: out of memory for %d bytes\n", size);
+		kfree(unlink_area(start));
+		return NULL;
+	}
+
+	kprof_alloc((void *) start, size);
+	return (void *) start;
+}
+
+/**
+ * @brief frees a buffer allocated by vmalloc
+ * @param p pointer returned by vmalloc
+ */
+void vfree(void *p)
+{
+	if (!p)
+		return;
+
+	struct varea *area = unlink_area((uintptr_t) p);
+	if (!area)
+	{
+		kprintf("vfree: 0x%x was not allocated by vmalloc\n", p);
+		return;
+	}
+
+	kprof_free(p);
+	vmm_unmap_kernel(area->start, area->pages);
+	kfree(area);
+}
+
+/**
+ * @brief maps device registers or firmware tables into the vmalloc area
+ * the pages are uncached and nothing is allocated to back them
+ * @param phys physical address of the range, it needn't be page aligned
+ * @param size size in bytes of the range
+ * @return pointer to phys, or NULL if out of memory or address space
+ */
+void *ioremap(uintptr_t phys, size_t size)
+{
+	if (size == 0)
+		return NULL;
+
+	uintptr_t offset = phys & (PAGE_SIZE - 1);
+	struct varea *area = claim((offset + size + PAGE_SIZE - 1) / PAGE_SIZE);
+	if (!area)
+		return NULL;
+
+	uintptr_t start = area->start;
+	if (vmm_map_mmio(start, phys - offset, area->pages) < 0)
+	{
+		kprintf("ioremap: out of memory for page tables\n");
+		kfree(unlink_area(start));
+		return NULL;
+	}
+
+	return (void *) (start + offset);
+}
+
+/**
+ * @brief unmaps a range mapped by ioremap
+ * @param p pointer returned by ioremap
+ */
+void iounmap(void *p)
+{
+	if (!p)
+		return;
+
+	struct varea *area = unlink_area((uintptr_t) p & ~(PAGE_SIZE - 1));
+	if (!area)
+	{
+		kprintf("iounmap: 0x%x was not mapped by ioremap\n", p);
+		return;
+	}
+
+	vmm_unmap_mmio(area->start, area->pages);
+	kfree(area);
+}
+
+/**
+ * @brief allocates a buffer from the heap if it's small and from vmalloc if it isn't
+ * for buffers whose size depends on their input, so small ones don't waste most of a page
+ * @param size size in bytes of the buffer
+ * @return pointer to the buffer or NULL if out of memory
+ */
+void *kvmalloc(size_t size)
+{
+	return size > PAGE_SIZE ? vmalloc(size) : kmalloc(size);
+}
+
+/**
+ * @brief frees a buffer allocated by kvmalloc
+ */
+void kvfree(void *p)
+{
+	if ((uintptr_t) p >= VMALLOC_BASE && (uintptr_t) p < VMALLOC_END)
+		vfree(p);
+	else
+		kfree(p);
+}
@@ -10,32 +10,41 @@
 
 #include <vmm.h>
 
+#include <cpu.h>
+#include <ext2.h>
 #include <intr.h>
 #include <kprintf.h>
 #include <kmalloc.h>
+#include <pcache.h>
 #include <pmm.h>
 #include <proc.h>
+#include <smp.h>
+#include <swap.h>
+#include <vma.h>
 
 #include <stdio.h>
 #include <string.h>
 
 extern struct proc nullproc;
+extern struct proc *proctab[];
 
 extern u32 start_phys, start;
 
 // defined in start.s - initial kernel stack
 extern u32 kstack_top;
 
-// pointer to heap, set by pmm_init after the PMM bitmap
-extern void *heap;
-
-// converts virtual address addr to a physical address
-#define VIRT_TO_PHYS(addr) ((u32) &start_phys + (u32) addr - (u32) &start)
 
 u32 *PAGE_DIR = (u32 *) 0xfffff000;
 void *PAGE_TABLES = (void *) 0xffc00000;
 
-static void page_fault();
+// set when the cpu supports 4M pages and they are enabled in cr4
+static bool large_pages;
+
+static void map_physical_memory(u32 *);
+static bool cow_fault(uintptr_t);
+static bool demand_fault(uintptr_t, bool);
+static bool large_fault(struct vma *, uintptr_t);
+static bool sync_kernel_pde(uintptr_t);
 
 /**
  * the bootloader kept data structures for initializing paging in the first ~10K of memory.
@@ -49,162 +58,750 @@ static void page_fault();
  */
 void vmm_init()
 {
-	set_vect(14, page_fault);
-
-    u32 *kpage_table = (u32 *) pmm_alloc();
-    u32 *kpage_dir = (u32 *) pmm_alloc();
-    u32 *ident_page_table = (u32 *) pmm_alloc();
+	// the buddy allocator makes no promise of handing out blocks inside the 1M the bootloader
+	// identity mapped, so these tables live in the kernel image where they are always reachable
+	static u32 kpage_table[NUM_TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+	static u32 kpage_dir[NUM_TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+	static u32 ident_page_table[NUM_TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
 
     for (int i = 0, phys = (int) &start_phys; i < 1024; i++, phys += PAGE_SIZE)
     {
         kpage_dir[i] = 0;
-        kpage_table[i] = phys | PT_PRESENT | PT_WRITABLE;
-        ident_page_table[i] = PT_PRESENT | PT_WRITABLE;
+        kpage_table[i] = phys | PT_PRESENT | PT_WRITABLE | PT_GLOBAL;
+        ident_page_table[i] = i < 256 ? (i * PAGE_SIZE) | PT_PRESENT | PT_WRITABLE : 0;
     }
 
     // set kernel pde for identity page table and kernel page table to new addr
-	kpage_dir[0] = (uintptr_t) ident_page_table | PT_PRESENT | PT_WRITABLE;
+	kpage_dir[0] = virt_to_phys(ident_page_table) | PT_PRESENT | PT_WRITABLE;
 	int i = (u32) &start / 0x400000; // index into kernel page directory that maps the kernel page table
-    kpage_dir[i] = (uintptr_t) kpage_table | PT_PRESENT | PT_WRITABLE;
+    kpage_dir[i] = virt_to_phys(kpage_table) | PT_PRESENT | PT_WRITABLE;
 
     // identity map final entry of kernel page directory
-    kpage_dir[1023] = (uintptr_t) kpage_dir | PT_PRESENT | PT_WRITABLE;
+    kpage_dir[1023] = virt_to_phys(kpage_dir) | PT_PRESENT | PT_WRITABLE;
 
 	// move physical address of kernel page directory to cr3
-	asm("mov %0, %%cr3" :: "r"(kpage_dir));
+	asm("mov %0, %%cr3" :: "r"(virt_to_phys(kpage_dir)));
+
+	if (cpu_has(CPUID_EDX_PSE))
+	{
+		write_cr4(read_cr4() | CR4_PSE);
+		large_pages = true;
+	}
+
+	// kernel pages are global so switching address spaces doesn't throw out their tlb entries.
+	// only leaf entries carry the bit: pdes double as ptes through the recursive mapping,
+	// and that mapping is different in every address space
+	if (cpu_has(CPUID_EDX_PGE))
+		write_cr4(read_cr4() | CR4_PGE);
+
+	// make read-only pages read-only for the kernel too (cr0.wp),
+	// otherwise kernel writes into user buffers would silently bypass copy-on-write
+	u32 cr0;
+	asm("mov %%cr0, %0" : "=r"(cr0));
+	asm("mov %0, %%cr0" :: "r"(cr0 | 0x10000));
 
     // map physical page of VGA framebuffer to kernel-space address
     // so it's accessible even when in user address spaces
-    vmm_map_page(0xb8000, 0xc00b8000, PT_PRESENT | PT_WRITABLE);
+    vmm_map_page(0xb8000, 0xc00b8000, PT_PRESENT | PT_WRITABLE | PT_GLOBAL);
 
-	nullproc.pdir = (uintptr_t) kpage_dir;
+	// this has to happen before any address space is created so they all share the direct map's pdes
+	map_physical_memory(kpage_dir);
+
+	nullproc.pdir = virt_to_phys(kpage_dir);
 	nullproc.stkbtm = (uintptr_t) &kstack_top;
-	kmalloc_init(heap, 1024 * 1024);
+
+	// the heap starts out small, kmalloc maps more as it needs it
+	kassert(vmm_map_kernel(KHEAP_BASE, KHEAP_INIT_SIZE / PAGE_SIZE) == 0, "vmm_init: out of memory for the kernel heap");
+	kmalloc_init((void *) KHEAP_BASE, KHEAP_INIT_SIZE);
+}
+
+/**
+ * @brief maps all of physical memory at PHYS_MAP_BASE
+ *
+ * the kernel image itself stays on 4K pages: it is linked at 0xc0000000 but loaded at
+ * 1M, and a 4M page can only map a 4M aligned physical address. the direct map has no
+ * such problem, so with pse each of its pdes maps 4M directly and no page tables are needed.
+ *
+ * @param pdir kernel page directory
+ */
+static void map_physical_memory(u32 *pdir)
+{
+	for (uintptr_t phys = 0; phys < pmm_mem_top(); phys += LARGE_PAGE_SIZE)
+	{
+		unsigned long pdindex = (PHYS_MAP_BASE + phys) >> 22;
+
+		if (large_pages)
+		{
+			pdir[pdindex] = phys | PT_PRESENT | PT_WRITABLE | PT_LARGE | PT_GLOBAL;
+			continue;
+		}
+
+		// no pse, fall back to a page table per 4M.
+		// the direct map doesn't exist yet, so the table is filled in through the recursive mapping
+		uintptr_t table_phys = pmm_alloc();
+		kassert(table_phys != 0, "map_physical_memory: out of memory for direct map page tables");
+		pmm_page(table_phys)->flags |= PG_PAGETABLE | PG_LOCKED;
+
+		pdir[pdindex] = table_phys | PT_PRESENT | PT_WRITABLE;
+
+		u32 *table = PAGE_TABLES + pdindex * PAGE_SIZE;
+		invlpg((uintptr_t) table);
+		for (int i = 0; i < NUM_TABLE_ENTRIES; i++)
+			table[i] = (phys + i * PAGE_SIZE) | PT_PRESENT | PT_WRITABLE | PT_GLOBAL;
+	}
 }
 
 uintptr_t vmm_create_address_space()
 {
-	// Allocate new physical page for page directory
-	uintptr_t pdir_phys = pmm_alloc();
+	// Allocate new physical page for page directory, already zeroed so user space (PDEs 0-767) starts out empty
+	uintptr_t pdir_phys = pmm_alloc_zeroed();
 	if (!pdir_phys)
 	{
 		kprintf("Error creating address space: failed to allocate page directory\n");
 		return 0;
 	}
 
-	// Temporarily map new page directory using PDE 511 (unused high memory slot)
-	// We need to access the new PD from kernel space to initialize it
-	int mask = disable();
-	u32 saved_cr3;
-	asm("mov %%cr3, %0" : "=r"(saved_cr3));
-
-	// Map the new page directory at a temporary location using PDE 511
-	PAGE_DIR[511] = pdir_phys | PT_PRESENT | PT_WRITABLE;
-
-	// Flush TLB for this entry
-	asm("mov %0, %%cr3" :: "r"(saved_cr3) : "memory");
+	pmm_page(pdir_phys)->flags |= PG_PAGETABLE;
 
-	// Access the new page directory through the temporary mapping
-	u32 *new_pdir = (u32 *) (PAGE_TABLES + 511 * PAGE_SIZE);
+	u32 *new_pdir = phys_to_virt(pdir_phys);
 
-	// Zero out user space entries (PDEs 0-767)
-	for (int i = 0; i < 768; i++)
-		new_pdir[i] = 0;
-
-	// Copy kernel PDEs (entries 768-1022) from current page directory
+	// Copy kernel PDEs (entries 768-1022) from the kernel page directory,
+	// the current one may be missing page tables added since it was created
+	u32 *kpdir = phys_to_virt(nullproc.pdir);
 	for (int i = 768; i < 1023; i++)
-		new_pdir[i] = PAGE_DIR[i];
+		new_pdir[i] = kpdir[i];
 
 	// Set up recursive mapping at entry 1023
 	new_pdir[1023] = pdir_phys | PT_PRESENT | PT_WRITABLE;
 
-	// Clean up temporary mapping
-	PAGE_DIR[511] = 0;
-
-	// Flush TLB again
-	asm("mov %0, %%cr3" :: "r"(saved_cr3) : "memory");
-
-	restore(mask);
-
 	return pdir_phys;
 }
 
-void vmm_map_page(uintptr_t phys, uintptr_t virt, unsigned flags)
+/**
+ * @brief maps a page into the current address space
+ * @param phys physical address of the frame to map
+ * @param virt virtual address to map it at
+ * @param flags PT_* flags for the page
+ * @return 0 on success, -1 if a page table couldn't be allocated
+ */
+int vmm_map_page(uintptr_t phys, uintptr_t virt, unsigned flags)
 {
     unsigned long pdindex = virt >> 22;
     unsigned long ptindex = virt >> 12 & 0x3ff;
     if (!(PAGE_DIR[pdindex] & PT_PRESENT))
     {
-        kprintf("%d not present\n", pdindex);
-        uintptr_t new_page = pmm_alloc();
-        PAGE_DIR[pdindex] = new_page | flags;
+        uintptr_t new_page = pmm_alloc_zeroed();
+        if (!new_page)
+            return -1;
+
+        pmm_page(new_page)->flags |= PG_PAGETABLE;
+        PAGE_DIR[pdindex] = new_page | PT_PRESENT | PT_WRITABLE | (flags & PT_USER);
+
+        // the new table is visible through the recursive mapping, drop whatever was cached for it
+        invlpg((uintptr_t) (PAGE_TABLES + pdindex * PAGE_SIZE));
     }
 
     u32 *page_table = PAGE_TABLES + pdindex * PAGE_SIZE;
     page_table[ptindex] = phys | flags;
+    return 0;
 }
 
-void vmm_map_page_in_pdir(uintptr_t pdir_phys, uintptr_t phys, uintptr_t virt, unsigned flags)
+/**
+ * @brief lets go of the frame a present user pte maps
+ *
+ * a page cache frame written through the pte since it was last synced keeps
+ * the write as PG_DIRTY, for the cache to write back before it drops the frame.
+ *
+ * @param pte the entry being cleared
+ */
+void vmm_drop_page(u32 pte)
+{
+	struct page *pg = pmm_page(pte & PT_FRAME);
+	if ((pte & PT_DIRTY) && (pg->flags & PG_PCACHE))
+		pg->flags |= PG_DIRTY;
+
+	pmm_unref(pte & PT_FRAME);
+}
+
+/**
+ * @brief frees an address space and every user frame mapped in it
+ *
+ * frames shared with other address spaces (copy-on-write, page cache) only lose
+ * a reference. kernel pdes are shared by every address space and are left alone.
+ * the address space must not be the one loaded in cr3.
+ *
+ * @param pdir_phys physical address of the page directory to free
+ */
+void vmm_destroy_address_space(uintptr_t pdir_phys)
+{
+	u32 *pdir = phys_to_virt(pdir_phys);
+
+	for (uint pdi = 0; pdi < KERNEL_BASE >> 22; pdi++)
+	{
+		if (!(pdir[pdi] & PT_PRESENT))
+			continue;
+
+		if (pdir[pdi] & PT_LARGE)
+		{
+			pmm_unref(pdir[pdi] & PT_FRAME);
+			continue;
+		}
+
+		u32 *table = phys_to_virt(pdir[pdi] & PT_FRAME);
+		for (int pti = 0; pti < NUM_TABLE_ENTRIES; pti++)
+		{
+			if (table[pti] & PT_PRESENT)
+				vmm_drop_page(table[pti]);
+			else if (table[pti] & PT_SWAP)
+				swap_free(table[pti]);
+		}
+
+		pmm_unref(pdir[pdi] & PT_FRAME);
+	}
+
+	pmm_unref(pdir_phys);
+}
+
+/**
+ * @brief finds the page table entry of a virtual address in the current address space
+ * @param virt virtual address to look up
+ * @return pointer to the entry, or NULL if there is no page table covering virt (including 4M pages)
+ */
+u32 *vmm_get_pte(uintptr_t virt)
 {
-	// Calculate page directory and page table indices
 	unsigned long pdindex = virt >> 22;
-	unsigned long ptindex = (virt >> 12) & 0x3ff;
+	unsigned long ptindex = virt >> 12 & 0x3ff;
 
-	// Save current CR3 and disable interrupts
-	u32 saved_cr3;
-	asm("mov %%cr3, %0" : "=r"(saved_cr3));
-	int mask = disable();
+	// 4M pages don't have a page table
+	if (!(PAGE_DIR[pdindex] & PT_PRESENT) || (PAGE_DIR[pdindex] & PT_LARGE))
+		return NULL;
 
-	// Switch to target page directory
-	asm("mov %0, %%cr3" :: "r"(pdir_phys) : "memory");
+	return (u32 *) (PAGE_TABLES + pdindex * PAGE_SIZE) + ptindex;
+}
+
+/**
+ * @brief finds the page directory entry of a virtual address in the current address space
+ */
+u32 *vmm_get_pde(uintptr_t virt)
+{
+	return &PAGE_DIR[virt >> 22];
+}
 
-	// Now we can use the recursive mapping to access this page directory
-	u32 *page_dir = (u32 *) 0xfffff000;
-	void *page_tables = (void *) 0xffc00000;
+int vmm_map_page_in_pdir(uintptr_t pdir_phys, uintptr_t phys, uintptr_t virt, unsigned flags)
+{
+	return vmm_map_range(pdir_phys, &phys, virt, 1, flags);
+}
 
-	// Check if page table exists
-	if (!(page_dir[pdindex] & PT_PRESENT))
+/**
+ * @brief maps a run of pages into any address space
+ *
+ * the page directory and page tables are edited through the direct map, so the
+ * target address space never has to be loaded into cr3. only when it is the current
+ * address space do the changed entries need to be invalidated, one page at a time.
+ *
+ * @param pdir_phys physical address of the page directory to map into
+ * @param phys physical addresses of the frames to map, one per page
+ * @param virt virtual address of the first page
+ * @param n number of pages to map
+ * @param flags PT_* flags for each page
+ * @return 0 on success, -1 if a page table couldn't be allocated
+ */
+int vmm_map_range(uintptr_t pdir_phys, const uintptr_t *phys, uintptr_t virt, size_t n, unsigned flags)
+{
+	u32 cr3;
+	asm("mov %%cr3, %0" : "=r"(cr3));
+	bool current = (cr3 & PT_FRAME) == (pdir_phys & PT_FRAME);
+
+	u32 *pdir = phys_to_virt(pdir_phys);
+
+	for (size_t i = 0; i < n; i++, virt += PAGE_SIZE)
 	{
-		// Allocate new page table
-		uintptr_t new_pt_phys = pmm_alloc();
-		if (!new_pt_phys)
+		unsigned long pdindex = virt >> 22;
+		unsigned long ptindex = virt >> 12 & 0x3ff;
+
+		if (!(pdir[pdindex] & PT_PRESENT))
 		{
-			// Restore original CR3 and interrupts before returning
-			asm("mov %0, %%cr3" :: "r"(saved_cr3) : "memory");
-			restore(mask);
-			return;
+			uintptr_t new_table = pmm_alloc_zeroed();
+			if (!new_table)
+				return -1;
+
+			pmm_page(new_table)->flags |= PG_PAGETABLE;
+			pdir[pdindex] = new_table | PT_PRESENT | PT_WRITABLE | (flags & PT_USER);
 		}
 
-		// Add PDE pointing to new page table FIRST
-		// PDE must be writable so we can modify the page table entries
-		unsigned pde_flags = PT_PRESENT | PT_WRITABLE;
-		if (flags & PT_USER)
-			pde_flags |= PT_USER;
-		page_dir[pdindex] = new_pt_phys | pde_flags;
+		u32 *table = phys_to_virt(pdir[pdindex] & PT_FRAME);
+		table[ptindex] = phys[i] | flags;
+
+		if (current)
+			invlpg(virt);
+	}
 
-		// Flush TLB by reloading CR3 so the new mapping takes effect
-		asm("mov %0, %%cr3" :: "r"(pdir_phys) : "memory");
+	return 0;
+}
 
-		// Now we can safely zero out the new page table
-		u32 *new_pt_virt = page_tables + pdindex * PAGE_SIZE;
-		for (int i = 0; i < 1024; i++)
-			new_pt_virt[i] = 0;
+/**
+ * @brief backs a run of kernel pages with new frames
+ *
+ * the pages are mapped in the kernel page directory. every address space shares its page
+ * tables, but a page table added here only shows up in address spaces created afterwards,
+ * older ones copy its pde the first time they fault on it (see sync_kernel_pde).
+ *
+ * @param virt first page to map, above KERNEL_BASE
+ * @param n number of pages
+ * @return 0 on success, -1 if out of memory, in which case nothing is left mapped
+ */
+int vmm_map_kernel(uintptr_t virt, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		uintptr_t frame = pmm_alloc();
+		if (!frame || vmm_map_range(nullproc.pdir, &frame, virt + i * PAGE_SIZE, 1, PT_PRESENT | PT_WRITABLE | PT_GLOBAL) < 0)
+		{
+			if (frame)
+				pmm_free(frame, 0);
+
+			vmm_unmap_kernel(virt, i);
+			return -1;
+		}
+
+		// kernel memory is never evicted
+		pmm_page(frame)->flags |= PG_LOCKED;
 	}
 
-	// Map the physical page in the page table
-	u32 *page_table = page_tables + pdindex * PAGE_SIZE;
-	page_table[ptindex] = phys | flags;
+	return 0;
+}
 
-	// Restore original CR3 and interrupts
-	asm("mov %0, %%cr3" :: "r"(saved_cr3) : "memory");
-	restore(mask);
+/**
+ * @brief maps device memory into kernel space, uncached
+ * @param virt first page to map, above KERNEL_BASE
+ * @param phys physical address of the first page, memory the pmm doesn't hand out
+ * @param n number of pages
+ * @return 0 on success, -1 if a page table couldn't be allocated, in which case nothing is left mapped
+ */
+int vmm_map_mmio(uintptr_t virt, uintptr_t phys, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		uintptr_t frame = phys + i * PAGE_SIZE;
+		if (vmm_map_range(nullproc.pdir, &frame, virt + i * PAGE_SIZE, 1, PT_PRESENT | PT_WRITABLE | PT_GLOBAL | PT_PCD | PT_PWT) < 0)
+		{
+			vmm_unmap_mmio(virt, i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief clears the ptes of a run of kernel pages
+ *
+ * the page tables stay, older address spaces may still have copies of their pdes.
+ * clearing the ptes is enough for every address space since they all share them.
+ *
+ * @param virt first page to unmap
+ * @param n number of pages
+ * @param free_frames whether the frames were allocated for the mapping and go back to the pmm
+ */
+static void unmap_kernel(uintptr_t virt, size_t n, bool free_frames)
+{
+	u32 *kpdir = phys_to_virt(nullproc.pdir);
+
+	for (size_t i = 0; i < n; i++, virt += PAGE_SIZE)
+	{
+		u32 *table = phys_to_virt(kpdir[virt >> 22] & PT_FRAME);
+		u32 *pte = &table[virt >> 12 & 0x3ff];
+
+		if (free_frames)
+			pmm_free(*pte & PT_FRAME, 0);
+
+		*pte = 0;
+
+		// global entries survive cr3 reloads, so this is the only thing that gets rid of them
+		invlpg(virt);
+	}
+
+	// the other cpus get rid of theirs before they next run in the kernel
+	if (n > 0)
+		smp_kernel_unmapped();
+}
+
+/**
+ * @brief unmaps a run of kernel pages mapped by vmm_map_kernel and frees their frames
+ * @param virt first page to unmap
+ * @param n number of pages
+ */
+void vmm_unmap_kernel(uintptr_t virt, size_t n)
+{
+	unmap_kernel(virt, n, true);
+}
+
+/**
+ * @brief unmaps a run of kernel pages mapped by vmm_map_mmio
+ * @param virt first page to unmap
+ * @param n number of pages
+ */
+void vmm_unmap_mmio(uintptr_t virt, size_t n)
+{
+	unmap_kernel(virt, n, false);
+}
+
+/**
+ * @brief zero fills a run of physical frames
+ * @param phys physical address of the first frame
+ * @param n number of frames
+ */
+void vmm_zero_frames(uintptr_t phys, size_t n)
+{
+	// a dword at a time instead of memset's byte at a time
+	void *dst = phys_to_virt(phys);
+	size_t count = n * PAGE_SIZE / 4;
+	asm volatile("rep stosl" : "+D"(dst), "+c"(count) : "a"(0) : "memory");
+}
+
+/**
+ * @brief copies a run of physical frames
+ * @param dst physical address of the first frame to copy to
+ * @param src physical address of the first frame to copy from
+ * @param n number of frames
+ */
+void vmm_copy_frames(uintptr_t dst, uintptr_t src, size_t n)
+{
+	memcpy(phys_to_virt(dst), phys_to_virt(src), n * PAGE_SIZE);
+}
+
+/**
+ * @brief whether user mappings can be backed by 4M pages
+ */
+bool vmm_has_large_pages()
+{
+	return large_pages;
+}
+
+/**
+ * @brief physical address of a kernel virtual address
+ *
+ * the direct map and the kernel image are linear, anything else is looked
+ * up in the current address space's page tables
+ *
+ * @param virt kernel virtual address
+ * @return physical address virt maps to, or 0 if it isn't mapped
+ */
+uintptr_t virt_to_phys(const void *virt)
+{
+	uintptr_t addr = (uintptr_t) virt;
+
+	if (addr >= PHYS_MAP_BASE && addr < PHYS_MAP_BASE + PHYS_MAP_SIZE)
+		return addr - PHYS_MAP_BASE;
+
+	if (addr >= (uintptr_t) &start && addr < (uintptr_t) &start + LARGE_PAGE_SIZE)
+		return (uintptr_t) &start_phys + addr - (uintptr_t) &start;
+
+	u32 *pde = vmm_get_pde(addr);
+	if ((*pde & PT_PRESENT) && (*pde & PT_LARGE))
+		return (*pde & PT_FRAME & ~(LARGE_PAGE_SIZE - 1)) + addr % LARGE_PAGE_SIZE;
+
+	u32 *pte = vmm_get_pte(addr);
+	if (!pte || !(*pte & PT_PRESENT))
+		return 0;
+
+	return (*pte & PT_FRAME) + addr % PAGE_SIZE;
 }
 
 /**
  * @brief page fault handler
+ * called by isr() for exception 14
+ * @param regs saved registers of the faulting context
+ * @return true if the fault was resolved and the faulting instruction can be restarted
  */
-static void page_fault()
+bool vmm_page_fault(struct registers *regs)
 {
-	kprintf("Page fault detected!\n");
-	while (1) ;
+	uintptr_t addr;
+	asm("mov %%cr2, %0" : "=r"(addr));
+
+	// kernel page tables added after this address space was created
+	if (addr >= KERNEL_BASE)
+		return !(regs->error_code & PF_USER) && sync_kernel_pde(addr);
+
+	bool write = regs->error_code & PF_WRITE;
+	bool resolved;
+	u32 *pte;
+
+	// writes to copy-on-write user pages
+	if (regs->error_code & PF_PRESENT)
+		resolved = write && cow_fault(addr);
+
+	// pages pushed out to swap under memory pressure. a swapped page that can't be
+	// read back fails the fault, demand paging it would hand out a blank page instead
+	else if ((pte = vmm_get_pte(addr)) && (*pte & PT_SWAP))
+		resolved = swap_in(addr, write);
+
+	// the first touch of a page in one of the process's areas
+	else
+		resolved = demand_fault(addr, write);
+
+	if (resolved)
+		curr->faults++;
+
+	return resolved;
+}
+
+/**
+ * @brief counts the resident, dirty, and recently used pages of every process
+ *
+ * called once a second by the clock. PT_ACCESSED is cleared on every page found with
+ * it set, so wss is the number of pages touched since the previous scan. pages found
+ * accessed are marked PG_REFERENCED, so the swap clock still sees that they were used
+ * even though this scan took their accessed bit away.
+ */
+void vmm_scan_usage()
+{
+	int mask = disable();
+	bool flush = false;
+
+	for (int pid = 0; pid < NPROC; pid++)
+	{
+		// a process running on another cpu keeps its counts from the last scan, that cpu
+		// could be setting a dirty bit while the accessed bit is cleared and lose it
+		struct proc *p = proctab[pid];
+		if (!p || !p->pdir || proc_running_elsewhere(p))
+			continue;
+
+		u32 *pdir = phys_to_virt(p->pdir);
+		u32 rss = 0, dirty = 0, wss = 0;
+
+		for (uint pdi = 0; pdi < KERNEL_BASE >> 22; pdi++)
+		{
+			u32 *pde = &pdir[pdi];
+			if (!(*pde & PT_PRESENT))
+				continue;
+
+			// a 4M page only has the one set of bits for all of it
+			if (*pde & PT_LARGE)
+			{
+				uint n = LARGE_PAGE_SIZE / PAGE_SIZE;
+				rss += n;
+
+				if (*pde & PT_DIRTY)
+					dirty += n;
+
+				if (*pde & PT_ACCESSED)
+				{
+					wss += n;
+					*pde &= ~PT_ACCESSED;
+					flush |= p == curr;
+				}
+
+				continue;
+			}
+
+			u32 *table = phys_to_virt(*pde & PT_FRAME);
+			for (int pti = 0; pti < NUM_TABLE_ENTRIES; pti++)
+			{
+				u32 *pte = &table[pti];
+				if (!(*pte & PT_PRESENT))
+					continue;
+
+				rss++;
+
+				if (*pte & PT_DIRTY)
+					dirty++;
+
+				if (*pte & PT_ACCESSED)
+				{
+					wss++;
+					*pte &= ~PT_ACCESSED;
+					pmm_page(*pte & PT_FRAME)->flags |= PG_REFERENCED;
+					flush |= p == curr;
+				}
+			}
+		}
+
+		p->rss   = rss;
+		p->dirty = dirty;
+		p->wss   = wss;
+	}
+
+	// other address spaces drop their tlb entries when they are switched to
+	if (flush)
+		asm volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" ::: "eax", "memory");
+
+	restore(mask);
+}
+
+/**
+ * @brief brings in a page of the current process the first time it is touched
+ *
+ * file pages come from the page cache. shared mappings, and private mappings that are
+ * only being read, map the cached frame itself (private ones copy-on-write), so reading
+ * a mapped file never copies. pages of file backed areas that end partway through
+ * (an elf segment followed by its bss) get a private copy with the tail zeroed,
+ * and anonymous pages are zero filled.
+ *
+ * @param addr faulting virtual address
+ * @param write whether the faulting access was a write
+ * @return true if addr is inside one of the process's areas and is now mapped
+ */
+static bool demand_fault(uintptr_t addr, bool write)
+{
+	struct vma *vma = vma_find(curr->vmas, addr);
+	if (!vma)
+		return false;
+
+	if (write && !(vma->flags & VMA_WRITE))
+		return false;
+
+	// a page table already covering this 4M (left behind by an earlier mapping) means 4K pages it is
+	if ((vma->flags & VMA_LARGE) && !(PAGE_DIR[addr >> 22] & PT_PRESENT) && large_fault(vma, addr))
+		return true;
+
+	uintptr_t page = addr & ~(PAGE_SIZE - 1);
+	size_t pos = page - vma->start;
+	bool shared = vma->flags & VMA_SHARED;
+
+	unsigned flags = PT_PRESENT | PT_USER;
+	if (vma->flags & VMA_WRITE)
+		flags |= PT_WRITABLE;
+
+	// file offsets that aren't page aligned can't come out of the cache
+	uintptr_t cached = 0;
+	if (vma->inode && vma->off % PAGE_SIZE == 0 && (shared || pos < vma->filesz))
+	{
+		cached = pcache_get(vma->inode, (vma->off + pos) / PAGE_SIZE);
+		if (!cached)
+			return false;
+
+		// held until the page is mapped or copied, allocating below may shrink the cache
+		pmm_ref(cached);
+
+		if (shared || (!write && pos + PAGE_SIZE <= vma->filesz))
+		{
+			if (!shared && (flags & PT_WRITABLE))
+				flags = (flags & ~PT_WRITABLE) | PT_COW;
+
+			if (vmm_map_page(cached, page, flags) < 0)
+			{
+				pmm_unref(cached);
+				return false;
+			}
+
+			return true;
+		}
+	}
+
+	// only pages the file fills completely can skip being zeroed
+	bool from_file = vma->inode && pos + PAGE_SIZE <= vma->filesz;
+	uintptr_t frame = from_file ? pmm_alloc() : pmm_alloc_zeroed();
+	if (!frame)
+	{
+		if (cached)
+			pmm_unref(cached);
+		return false;
+	}
+
+	pmm_page(frame)->owner = curr;
+
+	void *dst = phys_to_virt(frame);
+
+	if (vma->inode && pos < vma->filesz)
+	{
+		size_t n = vma->filesz - pos < PAGE_SIZE ? vma->filesz - pos : PAGE_SIZE;
+
+		if (cached)
+			memcpy(dst, phys_to_virt(cached), n);
+		else
+			ext2_read_data(dst, vma->inode, vma->off + pos, n);
+	}
+
+	if (cached)
+		pmm_unref(cached);
+
+	if (vmm_map_page(frame, page, flags) < 0)
+	{
+		pmm_unref(frame);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief backs the 4M of a large anonymous area around addr with a single 4M page
+ * @param vma area containing addr, 4M aligned
+ * @param addr faulting virtual address
+ * @return true if the page was mapped, false if no 4M run of memory was free
+ */
+static bool large_fault(struct vma *vma, uintptr_t addr)
+{
+	uintptr_t frame = pmm_alloc_order(PMM_MAX_ORDER);
+	if (!frame)
+		return false;
+
+	vmm_zero_frames(frame, LARGE_PAGE_SIZE / PAGE_SIZE);
+	pmm_page(frame)->owner = curr;
+
+	unsigned flags = PT_PRESENT | PT_USER | PT_LARGE;
+	if (vma->flags & VMA_WRITE)
+		flags |= PT_WRITABLE;
+
+	PAGE_DIR[addr >> 22] = frame | flags;
+	return true;
+}
+
+/**
+ * @brief gives the current process its own writable copy of a copy-on-write page
+ * @param addr faulting virtual address
+ * @return true if the page was copy-on-write and is now writable
+ */
+static bool cow_fault(uintptr_t addr)
+{
+	uintptr_t page = addr & ~(PAGE_SIZE - 1);
+
+	u32 *pte = vmm_get_pte(addr);
+	if (!pte || !(*pte & PT_COW))
+		return false;
+
+	uintptr_t frame = *pte & PT_FRAME;
+	unsigned flags = (*pte & ~PT_FRAME & ~PT_COW) | PT_WRITABLE;
+
+	// everybody else already broke away from this frame, so it can just be made writable again
+	if (pmm_refcount(frame) == 1)
+	{
+		*pte = frame | flags;
+		invlpg(page);
+		return true;
+	}
+
+	uintptr_t copy = pmm_alloc();
+	if (!copy)
+		return false;
+
+	memcpy(phys_to_virt(copy), (void *) page, PAGE_SIZE);
+	pmm_page(copy)->owner = curr;
+
+	*pte = copy | flags;
+	invlpg(page);
+	pmm_unref(frame);
+	return true;
+}
+
+/**
+ * @brief copies a kernel pde the current address space is missing from the kernel page directory
+ * @param addr faulting kernel address
+ * @return true if the kernel has a page table for addr and the current address space didn't
+ */
+static bool sync_kernel_pde(uintptr_t addr)
+{
+	unsigned long pdindex = addr >> 22;
+	u32 *kpdir = phys_to_virt(nullproc.pdir);
+
+	// the recursive mapping is the one kernel pde that differs between address spaces
+	if (pdindex == 1023)
+		return false;
+
+	if (!(kpdir[pdindex] & PT_PRESENT) || (PAGE_DIR[pdindex] & PT_PRESENT))
+		return false;
+
+	PAGE_DIR[pdindex] = kpdir[pdindex];
+	return true;
 }
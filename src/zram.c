@@ -0,0 +1,319 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: zram.c
+ * DATE: October 17th, 2026
+ * DESCRIPTION: compressed in-memory swap
+ */
+#include <zram.h>
+
+#include <intr.h>
+#include <kprintf.h>
+#include <lz.h>
+#include <pmm.h>
+#include <vmalloc.h>
+#include <vmm.h>
+
+#include <string.h>
+
+// which part of a block an entry's data is in
+#define ZE_SAME  0    // nothing stored, the page is val repeated
+#define ZE_FIRST 1    // at the start of the block
+#define ZE_LAST  2    // at the end of the block
+
+#define ZRAM_BUCKETS (PAGE_SIZE / ZRAM_CHUNK)
+
+// a page held by zram
+struct zentry
+{
+	u32 val;           // ZE_SAME: the repeated word. otherwise: physical address of the block holding the data
+	u16 len   : 14;    // size of the compressed data
+	u16 where : 2;     // ZE_*
+	u16 refs;          // number of ptes referring to the page, forked children share them (a u8 could wrap)
+	u32 next;          // free entries and lone pages waiting for a partner are kept on lists
+	u32 prev;
+};
+
+// entry 0 is never used, so 0 can mean none
+static struct zentry *entries;
+static u32 free_entries;
+
+// lone pages by the room left in their block, unbuddied[n] has at least n * ZRAM_CHUNK bytes free
+static u32 unbuddied[ZRAM_BUCKETS];
+
+// only used with interrupts off
+static u8 work[LZ_WORK_SIZE];
+static u8 scratch[ZRAM_MAX_LEN];
+
+// running average of how big pages compress to, pages that didn't compress count as PAGE_SIZE
+static size_t avg_len = PAGE_SIZE / 2;
+static uint skipped;
+
+static inline void *zdata(struct zentry *e)
+{
+	void *block = phys_to_virt(e->val);
+	return e->where == ZE_LAST ? block + PAGE_SIZE - e->len : block;
+}
+
+static void bucket_add(u32 idx)
+{
+	struct zentry *e = &entries[idx];
+	u32 b = (PAGE_SIZE - e->len) / ZRAM_CHUNK;
+
+	e->prev = 0;
+	e->next = unbuddied[b];
+	if (e->next)
+		entries[e->next].prev = idx;
+
+	unbuddied[b] = idx;
+}
+
+static void bucket_remove(u32 idx)
+{
+	struct zentry *e = &entries[idx];
+	u32 b = (PAGE_SIZE - e->len) / ZRAM_CHUNK;
+
+	if (e->prev)
+		entries[e->prev].next = e->next;
+	else
+		unbuddied[b] = e->next;
+
+	if (e->next)
+		entries[e->next].prev = e->prev;
+}
+
+/**
+ * @brief sets up the entry table, one entry for every block of memory
+ */
+void zram_init()
+{
+	u32 n = pmm_mem_top() / PAGE_SIZE;
+
+	entries = kvmalloc(n * sizeof(struct zentry));
+	if (!entries)
+	{
+		kprintf("zram: out of memory, running without it\n");
+		return;
+	}
+
+	for (u32 i = n - 1; i > 0; i--)
+	{
+		entries[i].next = free_entries;
+		free_entries = i;
+	}
+}
+
+/**
+ * @brief stores a page in zram
+ *
+ * on success zram has taken over the caller's reference to the block: it is either
+ * freed or made into the first half of a new pair. pages that compress badly are
+ * left alone for swap to put on disk, and while most of them do, compression isn't
+ * even tried on all but every ZRAM_PROBE'th page.
+ *
+ * @param frame block holding the page
+ * @param force try to compress no matter how well pages have been compressing, for when there's no disk
+ * @param freed set if the block was freed
+ * @return index of the page's entry or 0 if the page wasn't stored
+ */
+u32 zram_store(uintptr_t frame, bool force, bool *freed)
+{
+	int mask = disable();
+
+	if (!free_entries)
+	{
+		restore(mask);
+		return 0;
+	}
+
+	u32 *words = phys_to_virt(frame);
+	u32 idx = free_entries;
+	struct zentry *e = &entries[idx];
+
+	int i = 1;
+	while (i < PAGE_SIZE / 4 && words[i] == words[0])
+		i++;
+
+	if (i == PAGE_SIZE / 4)
+	{
+		free_entries = e->next;
+		e->val   = words[0];
+		e->len   = 0;
+		e->where = ZE_SAME;
+		e->refs  = 1;
+
+		restore(mask);
+		pmm_unref(frame);
+		*freed = true;
+		return idx;
+	}
+
+	if (!force && avg_len > ZRAM_MAX_LEN && ++skipped < ZRAM_PROBE)
+	{
+		restore(mask);
+		return 0;
+	}
+
+	skipped = 0;
+
+	size_t len = lz_compress(words, PAGE_SIZE, scratch, ZRAM_MAX_LEN, work);
+	avg_len = (avg_len * 7 + (len ? len : PAGE_SIZE)) / 8;
+
+	if (!len)
+	{
+		restore(mask);
+		return 0;
+	}
+
+	free_entries = e->next;
+	e->len  = len;
+	e->refs = 1;
+
+	// the lone page with the least room that this one still fits next to
+	u32 mate = 0;
+	for (u32 b = (len + ZRAM_CHUNK - 1) / ZRAM_CHUNK; b < ZRAM_BUCKETS && !mate; b++)
+		mate = unbuddied[b];
+
+	if (mate)
+	{
+		bucket_remove(mate);
+
+		struct zentry *m = &entries[mate];
+		struct page *pg = pmm_page(m->val);
+
+		e->val = m->val;
+		if (m->where == ZE_FIRST)
+		{
+			e->where = ZE_LAST;
+			pg->zlast = idx;
+		}
+
+		else
+		{
+			e->where = ZE_FIRST;
+			pg->zfirst = idx;
+		}
+
+		memcpy(zdata(e), scratch, len);
+		pmm_ref(e->val);
+
+		restore(mask);
+		pmm_unref(frame);
+		*freed = true;
+		return idx;
+	}
+
+	// nobody to pair with, the page's own block starts a new pair
+	struct page *pg = pmm_page(frame);
+	pg->flags  = PG_LOCKED | PG_ZRAM;
+	pg->zfirst = idx;
+	pg->zlast  = 0;
+
+	e->val   = frame;
+	e->where = ZE_FIRST;
+	memcpy(words, scratch, len);
+	bucket_add(idx);
+
+	restore(mask);
+	*freed = false;
+	return idx;
+}
+
+/**
+ * @brief copies a page out of zram
+ * @param idx entry of the page
+ * @param frame block to put it in
+ * @return false if the compressed data is corrupt
+ */
+bool zram_load(u32 idx, uintptr_t frame)
+{
+	int mask = disable();
+
+	struct zentry *e = &entries[idx];
+	u32 *words = phys_to_virt(frame);
+	bool ok = true;
+
+	if (e->where == ZE_SAME)
+	{
+		for (int i = 0; i < PAGE_SIZE / 4; i++)
+			words[i] = e->val;
+	}
+
+	else
+	{
+		ok = lz_decompress(zdata(e), e->len, words, PAGE_SIZE) == PAGE_SIZE;
+	}
+
+	restore(mask);
+
+	if (!ok)
+		kprintf("zram_load: entry %d is corrupt\n", idx);
+
+	return ok;
+}
+
+/**
+ * @brief takes another reference to a page, for a pte copied by fork
+ * @param idx entry of the page
+ */
+void zram_dup(u32 idx)
+{
+	int mask = disable();
+	entries[idx].refs++;
+	restore(mask);
+}
+
+/**
+ * @brief drops a reference to a page, freeing it when the last one goes away
+ *
+ * the other half of its block, if there is one, goes back to waiting for a partner.
+ * a block is freed once both its halves are.
+ *
+ * @param idx entry of the page
+ */
+void zram_free(u32 idx)
+{
+	int mask = disable();
+
+	struct zentry *e = &entries[idx];
+	if (--e->refs > 0)
+	{
+		restore(mask);
+		return;
+	}
+
+	uintptr_t block = 0;
+	if (e->where != ZE_SAME)
+	{
+		block = e->val;
+		struct page *pg = pmm_page(block);
+
+		u32 mate;
+		if (e->where == ZE_FIRST)
+		{
+			mate = pg->zlast;
+			pg->zfirst = 0;
+		}
+
+		else
+		{
+			mate = pg->zfirst;
+			pg->zlast = 0;
+		}
+
+		if (mate)
+			bucket_add(mate);
+		else
+			bucket_remove(idx);
+	}
+
+	e->next = free_entries;
+	free_entries = idx;
+
+	restore(mask);
+
+	if (block)
+		pmm_unref(block);
+}
@@ -13,6 +13,7 @@
 #include <malloc.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/kprof.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -69,6 +70,16 @@ int main(int argc, char **argv)
 			return 0;
 		}
 
+		// slab caches and the kernel allocation profile go to the serial console
+		if (strcmp(args[0], "kprof") == 0)
+		{
+			if (kprof_dump() < 0)
+				printf("kprof: kernel wasn't built with KMALLOC_PROFILE\n");
+
+			free(args);
+			continue;
+		}
+
 		// Fork a new process to run the command
 		run_command(args);
 
@@ -0,0 +1,41 @@
+/* maestro
+ * License: GPLv2
+ * See LICENSE.txt for full license text
+ * Author: Sam Kravitz
+ *
+ * FILE: user/ps/ps.c
+ * DATE: October 18th, 2026
+ * DESCRIPTION: ps - report process memory usage
+ */
+
+#include <stdio.h>
+#include <sys/memstat.h>
+
+// indexed by the kernel's enum prstate
+static const char *states[] = { "ready", "run", "wait", "sleep", "susp", "zomb" };
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+
+	struct memstat ms;
+
+	// sizes are in K, a page is 4K
+	printf("PID\tPPID\tSTATE\tRSS\tDIRTY\tWSS\tFAULTS\tSWAPIN\tNAME\n");
+
+	// the kernel says when pid has gone past the end of its process table
+	int ret;
+	for (int pid = 0; (ret = memstat(pid, &ms)) != MEMSTAT_END; pid++)
+	{
+		if (ret < 0)
+			continue;
+
+		const char *state = ms.state >= 0 && ms.state < (int) (sizeof(states) / sizeof(states[0])) ? states[ms.state] : "?";
+
+		printf("%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%s\n", ms.pid, ms.parent, state,
+			ms.rss * 4, ms.dirty * 4, ms.wss * 4, ms.faults, ms.swapins, ms.name);
+	}
+
+	return 0;
+}